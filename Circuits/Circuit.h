@@ -3,6 +3,7 @@
 
 #include "ethsnarks.hpp"
 #include "../Utils/Data.h"
+#include "../Utils/BlockFile.h"
 
 using namespace ethsnarks;
 
@@ -16,6 +17,7 @@ public:
     virtual ~Circuit() {};
     virtual void generateConstraints(bool onchainDataAvailability, unsigned int blockSize) = 0;
     virtual bool generateWitness(const json& input) = 0;
+    virtual bool generateWitness(const BlockFile& input) = 0;
     virtual BlockType getBlockType() = 0;
     virtual unsigned int getBlockSize() = 0;
     virtual void printInfo() = 0;
@@ -263,6 +263,12 @@ public:
         return generateWitness(input.get<Loopring::DepositBlock>());
     }
 
+    bool generateWitness(const BlockFile& input) override
+    {
+        Loopring::DepositBlock block;
+        return input.read(block) && generateWitness(block);
+    }
+
     BlockType getBlockType() override
     {
         return BlockType::Deposit;
@@ -469,6 +469,12 @@ public:
         return generateWitness(input.get<Loopring::InternalTransferBlock>());
     }
 
+    bool generateWitness(const BlockFile& input) override
+    {
+        Loopring::InternalTransferBlock block;
+        return input.read(block) && generateWitness(block);
+    }
+
     BlockType getBlockType() override
     {
         return BlockType::InternalTransfer;
@@ -410,6 +410,12 @@ public:
         return generateWitness(input.get<Loopring::OffchainWithdrawalBlock>());
     }
 
+    bool generateWitness(const BlockFile& input) override
+    {
+        Loopring::OffchainWithdrawalBlock block;
+        return input.read(block) && generateWitness(block);
+    }
+
     BlockType getBlockType() override
     {
         return BlockType::OffchainWithdrawal;
@@ -331,6 +331,12 @@ public:
         return generateWitness(input.get<Loopring::OnchainWithdrawalBlock>());
     }
 
+    bool generateWitness(const BlockFile& input) override
+    {
+        Loopring::OnchainWithdrawalBlock block;
+        return input.read(block) && generateWitness(block);
+    }
+
     BlockType getBlockType() override
     {
         return BlockType::OnchainWithdrawal;
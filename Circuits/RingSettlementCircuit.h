@@ -675,6 +675,12 @@ public:
         return generateWitness(input.get<Loopring::RingSettlementBlock>());
     }
 
+    bool generateWitness(const BlockFile& input) override
+    {
+        Loopring::RingSettlementBlock block;
+        return input.read(block) && generateWitness(block);
+    }
+
     BlockType getBlockType() override
     {
         return BlockType::RingSettlement;
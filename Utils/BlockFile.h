@@ -0,0 +1,41 @@
+#ifndef _BLOCKFILE_H_
+#define _BLOCKFILE_H_
+
+#include "Data.h"
+
+#include <string>
+
+
+namespace Loopring
+{
+
+/**
+* A block stored in a file (a JSON block or a binary block).
+*
+* The block is only read when the circuit reads it into its block class, so the
+* block data is never kept in memory in any other form.
+*/
+class BlockFile
+{
+public:
+    virtual ~BlockFile() {}
+
+    virtual BlockType getBlockType() const = 0;
+    virtual unsigned int getBlockSize() const = 0;
+    virtual bool getOnchainDataAvailability() const = 0;
+
+    // Hash of the canonical form of the block, see hashBlock in BlockIO.h
+    // (used to find the proofs of blocks that were already proven)
+    virtual std::string getHash() const = 0;
+
+    // Return false when the block could not be read as the requested block type
+    virtual bool read(RingSettlementBlock& block) const = 0;
+    virtual bool read(DepositBlock& block) const = 0;
+    virtual bool read(OnchainWithdrawalBlock& block) const = 0;
+    virtual bool read(OffchainWithdrawalBlock& block) const = 0;
+    virtual bool read(InternalTransferBlock& block) const = 0;
+};
+
+}
+
+#endif
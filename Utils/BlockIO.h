@@ -0,0 +1,680 @@
+#ifndef _BLOCKIO_H_
+#define _BLOCKIO_H_
+
+#include "Data.h"
+#include "BlockFile.h"
+#include "MappedFile.h"
+#include "Hash.h"
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+
+
+namespace Loopring
+{
+
+/**
+* Binary block format.
+*
+* Holds the same data as a JSON block, but every field element is stored as its value in
+* 32 bytes (little-endian limbs), so loading a block is a copy and a conversion to Montgomery
+* form per field element instead of parsing a decimal string.
+*
+* The records have a fixed layout: the members of the classes in Data.h in the order of
+* the serialize functions below. Lists (Merkle proofs, the transactions of a block) are
+* preceded by their length as a uint32. A file with a different version is rejected and
+* needs to be converted again from the JSON block.
+*/
+struct BlockFileHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t blockType;
+    uint32_t blockSize;
+    uint32_t onchainDataAvailability;
+    uint64_t dataSize;
+};
+
+static const char* BLOCK_FILE_MAGIC = "LRCBLK1";
+static const uint32_t BLOCK_FILE_VERSION = 1;
+static const size_t FIELD_ELEMENT_SIZE = 32;
+
+typedef decltype(ethsnarks::FieldT().as_bigint()) FieldBigIntT;
+static_assert(sizeof(FieldBigIntT().data) == FIELD_ELEMENT_SIZE, "Unexpected field element size");
+static_assert(sizeof(ethsnarks::LimbT().data) == FIELD_ELEMENT_SIZE, "Unexpected limb size");
+
+/**
+* Appends the binary records of a block. When a hasher is given the records are only
+* hashed, not stored.
+*/
+class BlockWriter
+{
+public:
+    BlockWriter(Sha256* _hasher = nullptr) :
+        hasher(_hasher)
+    {
+
+    }
+
+    void operator()(const ethsnarks::FieldT& value)
+    {
+        FieldBigIntT bigint = value.as_bigint();
+        append(bigint.data, sizeof(bigint.data));
+    }
+
+    void operator()(const ethsnarks::LimbT& value)
+    {
+        append(value.data, sizeof(value.data));
+    }
+
+    void operator()(const ethsnarks::jubjub::EdwardsPoint& point)
+    {
+        (*this)(point.x);
+        (*this)(point.y);
+    }
+
+    template<typename T>
+    void operator()(const std::vector<T>& values)
+    {
+        uint32_t count = values.size();
+        append(&count, sizeof(count));
+        for (const T& value : values)
+        {
+            (*this)(value);
+        }
+    }
+
+    template<typename T>
+    void operator()(const T& value)
+    {
+        serialize(*this, const_cast<T&>(value));
+    }
+
+    std::vector<uint8_t> data;
+
+private:
+
+    void append(const void* src, size_t size)
+    {
+        if (hasher)
+        {
+            hasher->update(src, size);
+            return;
+        }
+        const uint8_t* bytes = static_cast<const uint8_t*>(src);
+        data.insert(data.end(), bytes, bytes + size);
+    }
+
+    Sha256* hasher;
+};
+
+/**
+* Reads the binary records of a block from memory. Reading past the end of the data
+* only marks the reader as invalid.
+*/
+class BlockReader
+{
+public:
+    BlockReader(const uint8_t* _data, size_t size) :
+        data(_data),
+        end(_data + size),
+        valid(true)
+    {
+
+    }
+
+    void operator()(ethsnarks::FieldT& value)
+    {
+        FieldBigIntT bigint;
+        if (read(bigint.data, sizeof(bigint.data)))
+        {
+            value = ethsnarks::FieldT(bigint);
+        }
+    }
+
+    void operator()(ethsnarks::LimbT& value)
+    {
+        read(value.data, sizeof(value.data));
+    }
+
+    void operator()(ethsnarks::jubjub::EdwardsPoint& point)
+    {
+        (*this)(point.x);
+        (*this)(point.y);
+    }
+
+    template<typename T>
+    void operator()(std::vector<T>& values)
+    {
+        uint32_t count = 0;
+        if (!read(&count, sizeof(count)) || count > size_t(end - data))
+        {
+            valid = false;
+            return;
+        }
+        values.resize(count);
+        for (T& value : values)
+        {
+            (*this)(value);
+        }
+    }
+
+    template<typename T>
+    void operator()(T& value)
+    {
+        serialize(*this, value);
+    }
+
+    // True when all data was read without running out of data
+    bool isValid() const
+    {
+        return valid && data == end;
+    }
+
+private:
+
+    bool read(void* dst, size_t size)
+    {
+        if (!valid || size > size_t(end - data))
+        {
+            valid = false;
+            return false;
+        }
+        memcpy(dst, data, size);
+        data += size;
+        return true;
+    }
+
+    const uint8_t* data;
+    const uint8_t* end;
+    bool valid;
+};
+
+template<typename Archive>
+static void serialize(Archive& ar, Proof& proof)
+{
+    ar(proof.data);
+}
+
+template<typename Archive>
+static void serialize(Archive& ar, TradeHistoryLeaf& leaf)
+{
+    ar(leaf.filled);
+    ar(leaf.orderID);
+}
+
+template<typename Archive>
+static void serialize(Archive& ar, BalanceLeaf& leaf)
+{
+    ar(leaf.balance);
+    ar(leaf.tradingHistoryRoot);
+}
+
+template<typename Archive>
+static void serialize(Archive& ar, Account& account)
+{
+    ar(account.publicKey);
+    ar(account.nonce);
+    ar(account.balancesRoot);
+}
+
+template<typename Archive>
+static void serialize(Archive& ar, BalanceUpdate& balanceUpdate)
+{
+    ar(balanceUpdate.tokenID);
+    ar(balanceUpdate.proof);
+    ar(balanceUpdate.rootBefore);
+    ar(balanceUpdate.rootAfter);
+    ar(balanceUpdate.before);
+    ar(balanceUpdate.after);
+}
+
+template<typename Archive>
+static void serialize(Archive& ar, TradeHistoryUpdate& tradeHistoryUpdate)
+{
+    ar(tradeHistoryUpdate.orderID);
+    ar(tradeHistoryUpdate.proof);
+    ar(tradeHistoryUpdate.rootBefore);
+    ar(tradeHistoryUpdate.rootAfter);
+    ar(tradeHistoryUpdate.before);
+    ar(tradeHistoryUpdate.after);
+}
+
+template<typename Archive>
+static void serialize(Archive& ar, AccountUpdate& accountUpdate)
+{
+    ar(accountUpdate.accountID);
+    ar(accountUpdate.proof);
+    ar(accountUpdate.rootBefore);
+    ar(accountUpdate.rootAfter);
+    ar(accountUpdate.before);
+    ar(accountUpdate.after);
+}
+
+template<typename Archive>
+static void serialize(Archive& ar, Signature& signature)
+{
+    ar(signature.R);
+    ar(signature.s);
+}
+
+template<typename Archive>
+static void serialize(Archive& ar, Order& order)
+{
+    ar(order.exchangeID);
+    ar(order.orderID);
+    ar(order.accountID);
+    ar(order.tokenS);
+    ar(order.tokenB);
+    ar(order.amountS);
+    ar(order.amountB);
+    ar(order.allOrNone);
+    ar(order.validSince);
+    ar(order.validUntil);
+    ar(order.maxFeeBips);
+    ar(order.buy);
+
+    ar(order.feeBips);
+    ar(order.rebateBips);
+
+    ar(order.signature);
+}
+
+template<typename Archive>
+static void serialize(Archive& ar, Ring& ring)
+{
+    ar(ring.orderA);
+    ar(ring.orderB);
+    ar(ring.fillS_A);
+    ar(ring.fillS_B);
+}
+
+template<typename Archive>
+static void serialize(Archive& ar, RingSettlement& ringSettlement)
+{
+    ar(ringSettlement.ring);
+
+    ar(ringSettlement.accountsMerkleRoot);
+
+    ar(ringSettlement.tradeHistoryUpdate_A);
+    ar(ringSettlement.tradeHistoryUpdate_B);
+
+    ar(ringSettlement.balanceUpdateS_A);
+    ar(ringSettlement.balanceUpdateB_A);
+    ar(ringSettlement.accountUpdate_A);
+
+    ar(ringSettlement.balanceUpdateS_B);
+    ar(ringSettlement.balanceUpdateB_B);
+    ar(ringSettlement.accountUpdate_B);
+
+    ar(ringSettlement.balanceUpdateA_P);
+    ar(ringSettlement.balanceUpdateB_P);
+
+    ar(ringSettlement.balanceUpdateA_O);
+    ar(ringSettlement.balanceUpdateB_O);
+}
+
+template<typename Archive>
+static void serialize(Archive& ar, RingSettlementBlock& block)
+{
+    ar(block.exchangeID);
+
+    ar(block.merkleRootBefore);
+    ar(block.merkleRootAfter);
+
+    ar(block.timestamp);
+
+    ar(block.protocolTakerFeeBips);
+    ar(block.protocolMakerFeeBips);
+
+    ar(block.signature);
+
+    ar(block.accountUpdate_P);
+
+    ar(block.operatorAccountID);
+    ar(block.accountUpdate_O);
+
+    ar(block.ringSettlements);
+}
+
+template<typename Archive>
+static void serialize(Archive& ar, Deposit& deposit)
+{
+    ar(deposit.amount);
+    ar(deposit.balanceUpdate);
+    ar(deposit.accountUpdate);
+}
+
+template<typename Archive>
+static void serialize(Archive& ar, DepositBlock& block)
+{
+    ar(block.exchangeID);
+
+    ar(block.merkleRootBefore);
+    ar(block.merkleRootAfter);
+
+    ar(block.startHash);
+
+    ar(block.startIndex);
+    ar(block.count);
+
+    ar(block.deposits);
+}
+
+template<typename Archive>
+static void serialize(Archive& ar, OnchainWithdrawal& withdrawal)
+{
+    ar(withdrawal.amountRequested);
+    ar(withdrawal.balanceUpdate);
+    ar(withdrawal.accountUpdate);
+}
+
+template<typename Archive>
+static void serialize(Archive& ar, OnchainWithdrawalBlock& block)
+{
+    ar(block.exchangeID);
+
+    ar(block.merkleRootBefore);
+    ar(block.merkleRootAfter);
+
+    ar(block.startHash);
+
+    ar(block.startIndex);
+    ar(block.count);
+
+    ar(block.withdrawals);
+}
+
+template<typename Archive>
+static void serialize(Archive& ar, OffchainWithdrawal& withdrawal)
+{
+    ar(withdrawal.amountRequested);
+    ar(withdrawal.fee);
+    ar(withdrawal.signature);
+
+    ar(withdrawal.balanceUpdateF_A);
+    ar(withdrawal.balanceUpdateW_A);
+    ar(withdrawal.accountUpdate_A);
+    ar(withdrawal.balanceUpdateF_O);
+}
+
+template<typename Archive>
+static void serialize(Archive& ar, OffchainWithdrawalBlock& block)
+{
+    ar(block.exchangeID);
+
+    ar(block.merkleRootBefore);
+    ar(block.merkleRootAfter);
+
+    ar(block.startHash);
+
+    ar(block.operatorAccountID);
+    ar(block.accountUpdate_O);
+
+    ar(block.withdrawals);
+}
+
+template<typename Archive>
+static void serialize(Archive& ar, InternalTransfer& interTrans)
+{
+    ar(interTrans.fee);
+    ar(interTrans.amount);
+    ar(interTrans.type);
+    ar(interTrans.signature);
+
+    ar(interTrans.numConditionalTransfersAfter);
+
+    ar(interTrans.balanceUpdateF_From);
+    ar(interTrans.balanceUpdateT_From);
+    ar(interTrans.accountUpdate_From);
+
+    ar(interTrans.balanceUpdateT_To);
+    ar(interTrans.accountUpdate_To);
+
+    ar(interTrans.balanceUpdateF_O);
+}
+
+template<typename Archive>
+static void serialize(Archive& ar, InternalTransferBlock& block)
+{
+    ar(block.exchangeID);
+
+    ar(block.merkleRootBefore);
+    ar(block.merkleRootAfter);
+
+    ar(block.operatorAccountID);
+    ar(block.accountUpdate_O);
+
+    ar(block.transfers);
+}
+
+static BlockFileHeader getBlockFileHeader(BlockType blockType, unsigned int blockSize, bool onchainDataAvailability, uint64_t dataSize)
+{
+    BlockFileHeader header;
+    memset(&header, 0, sizeof(header));
+    strncpy(header.magic, BLOCK_FILE_MAGIC, sizeof(header.magic));
+    header.version = BLOCK_FILE_VERSION;
+    header.blockType = uint32_t(blockType);
+    header.blockSize = blockSize;
+    header.onchainDataAvailability = onchainDataAvailability ? 1 : 0;
+    header.dataSize = dataSize;
+    return header;
+}
+
+/**
+* Hash of the canonical form of a block: its binary block file, with the data size left
+* out of the header so the records can be hashed while they are written.
+*
+* The hash only depends on the parsed block (with its Merkle proofs resolved), so the same
+* block has the same hash however it was sent: as JSON with any formatting, member order or
+* proof encoding, as a json object or as a binary block.
+*/
+template<typename BlockT>
+static std::string hashBlock(BlockType blockType, unsigned int blockSize, bool onchainDataAvailability, const BlockT& block)
+{
+    Sha256 hasher;
+    BlockFileHeader header = getBlockFileHeader(blockType, blockSize, onchainDataAvailability, 0);
+    hasher.update(&header, sizeof(header));
+    BlockWriter writer(&hasher);
+    writer(block);
+    return hasher.finalize();
+}
+
+template<typename BlockT>
+static std::string hashBlockFile(const BlockFile& blockFile)
+{
+    BlockT block;
+    if (!blockFile.read(block))
+    {
+        return "";
+    }
+    return hashBlock(blockFile.getBlockType(), blockFile.getBlockSize(), blockFile.getOnchainDataAvailability(), block);
+}
+
+// Reads the block to hash it. Returns an empty string when the block can't be read.
+static std::string hashBlock(const BlockFile& blockFile)
+{
+    switch (blockFile.getBlockType())
+    {
+        case BlockType::RingSettlement: return hashBlockFile<RingSettlementBlock>(blockFile);
+        case BlockType::Deposit: return hashBlockFile<DepositBlock>(blockFile);
+        case BlockType::OnchainWithdrawal: return hashBlockFile<OnchainWithdrawalBlock>(blockFile);
+        case BlockType::OffchainWithdrawal: return hashBlockFile<OffchainWithdrawalBlock>(blockFile);
+        case BlockType::InternalTransfer: return hashBlockFile<InternalTransferBlock>(blockFile);
+        default: return "";
+    }
+}
+
+template<typename BlockT>
+static std::string hashJsonBlock(const json& input)
+{
+    return hashBlock(BlockType(input.at("blockType").get<int>()), input.at("blockSize").get<unsigned int>(),
+                     input.at("onchainDataAvailability").get<bool>(), input.get<BlockT>());
+}
+
+// Throws when the block is invalid
+static std::string hashBlock(const json& input)
+{
+    switch (BlockType(input.at("blockType").get<int>()))
+    {
+        case BlockType::RingSettlement: return hashJsonBlock<RingSettlementBlock>(input);
+        case BlockType::Deposit: return hashJsonBlock<DepositBlock>(input);
+        case BlockType::OnchainWithdrawal: return hashJsonBlock<OnchainWithdrawalBlock>(input);
+        case BlockType::OffchainWithdrawal: return hashJsonBlock<OffchainWithdrawalBlock>(input);
+        case BlockType::InternalTransfer: return hashJsonBlock<InternalTransferBlock>(input);
+        default: return "";
+    }
+}
+
+// Writes a block in the binary format
+template<typename BlockT>
+static bool writeBinaryBlock(const std::string& filename, BlockType blockType, unsigned int blockSize, bool onchainDataAvailability, const BlockT& block)
+{
+    BlockWriter writer;
+    writer(block);
+    BlockFileHeader header = getBlockFileHeader(blockType, blockSize, onchainDataAvailability, writer.data.size());
+
+    // Write to a temporary file first so a crash never leaves a partial block
+    std::string tmpFilename = filename + ".tmp";
+    FILE* file = fopen(tmpFilename.c_str(), "wb");
+    if (file == nullptr)
+    {
+        std::cerr << "Cannot create binary block: " << tmpFilename << std::endl;
+        return false;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+              fwrite(writer.data.data(), 1, writer.data.size(), file) == writer.data.size();
+    ok = (fclose(file) == 0) && ok;
+    if (!ok || std::rename(tmpFilename.c_str(), filename.c_str()) != 0)
+    {
+        std::cerr << "Failed to write binary block: " << filename << std::endl;
+        std::remove(tmpFilename.c_str());
+        return false;
+    }
+    return true;
+}
+
+// Returns true if the file starts like a binary block (otherwise it's expected to be JSON)
+static bool isBinaryBlock(const std::string& filename)
+{
+    char magic[8] = {0};
+    FILE* file = fopen(filename.c_str(), "rb");
+    if (file == nullptr)
+    {
+        return false;
+    }
+    bool ok = fread(magic, sizeof(magic), 1, file) == 1;
+    fclose(file);
+    return ok && strncmp(magic, BLOCK_FILE_MAGIC, sizeof(magic)) == 0;
+}
+
+/**
+* A binary block mapped in memory.
+*/
+class BinaryBlock : public BlockFile
+{
+public:
+    BinaryBlock()
+    {
+        memset(&header, 0, sizeof(header));
+    }
+
+    bool open(const std::string& filename)
+    {
+        if (!file.open(filename))
+        {
+            return false;
+        }
+        if (file.size >= sizeof(header))
+        {
+            memcpy(&header, file.data, sizeof(header));
+        }
+        if (file.size < sizeof(header) || strncmp(header.magic, BLOCK_FILE_MAGIC, sizeof(header.magic)) != 0 ||
+            header.version != BLOCK_FILE_VERSION || sizeof(header) + header.dataSize != file.size)
+        {
+            std::cerr << "Invalid binary block (version " << header.version << ", expected " << BLOCK_FILE_VERSION << "): " << filename << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    bool isOpen() const
+    {
+        return file.data != nullptr;
+    }
+
+    BlockType getBlockType() const override
+    {
+        return BlockType(header.blockType);
+    }
+
+    unsigned int getBlockSize() const override
+    {
+        return header.blockSize;
+    }
+
+    bool getOnchainDataAvailability() const override
+    {
+        return header.onchainDataAvailability != 0;
+    }
+
+    // The records are stored in their canonical form, only the header needs to be adjusted
+    std::string getHash() const override
+    {
+        Sha256 hasher;
+        BlockFileHeader canonical = getBlockFileHeader(getBlockType(), getBlockSize(), getOnchainDataAvailability(), 0);
+        hasher.update(&canonical, sizeof(canonical));
+        hasher.update(file.data + sizeof(header), header.dataSize);
+        return hasher.finalize();
+    }
+
+    bool read(RingSettlementBlock& block) const override
+    {
+        return readBlock(block);
+    }
+
+    bool read(DepositBlock& block) const override
+    {
+        return readBlock(block);
+    }
+
+    bool read(OnchainWithdrawalBlock& block) const override
+    {
+        return readBlock(block);
+    }
+
+    bool read(OffchainWithdrawalBlock& block) const override
+    {
+        return readBlock(block);
+    }
+
+    bool read(InternalTransferBlock& block) const override
+    {
+        return readBlock(block);
+    }
+
+private:
+
+    // Returns false when the data doesn't have the layout of the block
+    template<typename BlockT>
+    bool readBlock(BlockT& block) const
+    {
+        BlockReader reader(file.data + sizeof(header), header.dataSize);
+        reader(block);
+        if (!reader.isValid())
+        {
+            std::cerr << "Binary block does not match the block layout!" << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    MappedFile file;
+    BlockFileHeader header;
+};
+
+}
+
+#endif
@@ -0,0 +1,1314 @@
+#ifndef _BLOCKJSON_H_
+#define _BLOCKJSON_H_
+
+#include "Data.h"
+#include "BlockFile.h"
+#include "BlockIO.h"
+#include "MappedFile.h"
+#include "JobQueue.h"
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <memory>
+#include <thread>
+#include <istream>
+#include <streambuf>
+#include <cstring>
+
+
+namespace Loopring
+{
+
+/**
+* Streaming (SAX) reader for JSON blocks.
+*
+* Parsing a block to a json document and then converting it to the block classes keeps
+* the block in memory in both forms (and the json document takes several times the
+* size of the file). Instead, the values are written directly into the block classes
+* while the file is parsed.
+*
+* The JSON members of the classes are described by the jsonFields functions in Data.h
+* (the same names and types as in the from_json functions). All members are required,
+* unknown members are skipped and repeated members are rejected.
+*/
+struct JsonTarget;
+
+// Returns false for unknown members, 'index' identifies the member within the object
+typedef bool (*JsonMemberFunc)(void* object, const std::string& key, JsonTarget& target, unsigned int& index);
+typedef void (*JsonElementFunc)(void* values, JsonTarget& target);
+
+// Where a JSON value is stored
+struct JsonTarget
+{
+    enum class Type
+    {
+        Skip,
+        Field,
+        Limb,
+        UInt,
+        Bool,
+        // An object and/or an array, depending on which functions are set
+        Container
+    };
+
+    JsonTarget() :
+        type(Type::Skip),
+        ptr(nullptr),
+        numMembers(0),
+        member(nullptr),
+        element(nullptr)
+    {
+
+    }
+
+    Type type;
+    void* ptr;
+    // Object: number of members and the function to find the target of a member
+    unsigned int numMembers;
+    JsonMemberFunc member;
+    // Array: the function to append an element and get its target
+    JsonElementFunc element;
+};
+
+static JsonTarget jsonValueTarget(JsonTarget::Type type, void* ptr)
+{
+    JsonTarget target;
+    target.type = type;
+    target.ptr = ptr;
+    return target;
+}
+
+static JsonTarget jsonTarget(ethsnarks::FieldT& value)
+{
+    return jsonValueTarget(JsonTarget::Type::Field, &value);
+}
+
+static JsonTarget jsonTarget(ethsnarks::LimbT& value)
+{
+    return jsonValueTarget(JsonTarget::Type::Limb, &value);
+}
+
+static JsonTarget jsonTarget(unsigned int& value)
+{
+    return jsonValueTarget(JsonTarget::Type::UInt, &value);
+}
+
+static JsonTarget jsonTarget(bool& value)
+{
+    return jsonValueTarget(JsonTarget::Type::Bool, &value);
+}
+
+template<typename T>
+static JsonTarget jsonTarget(std::vector<T>& values);
+
+static JsonTarget jsonTarget(Proof& proof);
+
+class JsonMemberFinder
+{
+public:
+    JsonMemberFinder(const std::string& _key, JsonTarget& _target) :
+        key(_key),
+        target(_target),
+        found(false),
+        index(0)
+    {
+
+    }
+
+    template<typename T>
+    void operator()(const char* name, T& value)
+    {
+        if (found)
+        {
+            return;
+        }
+        if (key == name)
+        {
+            target = jsonTarget(value);
+            found = true;
+            return;
+        }
+        index++;
+    }
+
+    const std::string& key;
+    JsonTarget& target;
+    bool found;
+    unsigned int index;
+};
+
+class JsonMemberCounter
+{
+public:
+    JsonMemberCounter() :
+        count(0)
+    {
+
+    }
+
+    template<typename T>
+    void operator()(const char* name, T& value)
+    {
+        count++;
+    }
+
+    unsigned int count;
+};
+
+template<typename T>
+static bool jsonMember(void* object, const std::string& key, JsonTarget& target, unsigned int& index)
+{
+    JsonMemberFinder finder(key, target);
+    jsonFields(finder, *static_cast<T*>(object));
+    index = finder.index;
+    return finder.found;
+}
+
+template<typename T>
+static void jsonElement(void* values, JsonTarget& target)
+{
+    std::vector<T>& vec = *static_cast<std::vector<T>*>(values);
+    vec.emplace_back();
+    target = jsonTarget(vec.back());
+}
+
+template<typename T>
+static JsonTarget jsonTarget(T& object)
+{
+    JsonMemberCounter counter;
+    jsonFields(counter, object);
+
+    JsonTarget target = jsonValueTarget(JsonTarget::Type::Container, &object);
+    target.numMembers = counter.count;
+    target.member = &jsonMember<T>;
+    return target;
+}
+
+template<typename T>
+static JsonTarget jsonTarget(std::vector<T>& values)
+{
+    JsonTarget target = jsonValueTarget(JsonTarget::Type::Container, &values);
+    target.element = &jsonElement<T>;
+    return target;
+}
+
+static void jsonProofSibling(void* proof, JsonTarget& target)
+{
+    jsonElement<ethsnarks::FieldT>(&static_cast<Proof*>(proof)->data, target);
+}
+
+// A Merkle proof is either an array of field elements or a delta encoded proof (an object)
+static JsonTarget jsonTarget(Proof& proof)
+{
+    JsonTarget target = jsonTarget<Proof>(proof);
+    target.element = &jsonProofSibling;
+    return target;
+}
+
+// Block meta data, used to find the circuit of the block
+struct BlockMeta
+{
+    unsigned int blockType;
+    unsigned int blockSize;
+    bool onchainDataAvailability;
+};
+
+template<typename Visitor>
+static void jsonFields(Visitor& v, BlockMeta& meta)
+{
+    v("blockType", meta.blockType);
+    v("blockSize", meta.blockSize);
+    v("onchainDataAvailability", meta.onchainDataAvailability);
+}
+
+/**
+* SAX handler writing the values in the targets.
+*/
+class JsonBlockParser
+{
+public:
+    // 'stopWhenComplete': stop parsing once all members of the root object were read
+    // 'basePath': path of the root value in the block (for errors)
+    JsonBlockParser(const JsonTarget& _root, bool _stopWhenComplete = false, const std::string& _basePath = "") :
+        root(_root),
+        stopWhenComplete(_stopWhenComplete),
+        basePath(_basePath),
+        skipDepth(0),
+        complete(false)
+    {
+
+    }
+
+    bool null()
+    {
+        return skipDepth > 0 || setValue("null", [](const JsonTarget& target) {
+            return target.type == JsonTarget::Type::Skip;
+        });
+    }
+
+    bool boolean(bool val)
+    {
+        return skipDepth > 0 || setValue("bool", [val](const JsonTarget& target) {
+            switch (target.type)
+            {
+                case JsonTarget::Type::Field: *static_cast<ethsnarks::FieldT*>(target.ptr) = ethsnarks::FieldT(val ? 1 : 0); return true;
+                case JsonTarget::Type::Bool: *static_cast<bool*>(target.ptr) = val; return true;
+                case JsonTarget::Type::Skip: return true;
+                default: return false;
+            }
+        });
+    }
+
+    bool number_integer(json::number_integer_t val)
+    {
+        return skipDepth > 0 || setValue("number", [val](const JsonTarget& target) {
+            return target.type == JsonTarget::Type::Skip || (val >= 0 && setUnsigned(target, json::number_unsigned_t(val)));
+        });
+    }
+
+    bool number_unsigned(json::number_unsigned_t val)
+    {
+        return skipDepth > 0 || setValue("number", [val](const JsonTarget& target) {
+            return target.type == JsonTarget::Type::Skip || setUnsigned(target, val);
+        });
+    }
+
+    bool number_float(json::number_float_t val, const json::string_t& s)
+    {
+        return skipDepth > 0 || setValue("number", [](const JsonTarget& target) {
+            return target.type == JsonTarget::Type::Skip;
+        });
+    }
+
+    bool string(json::string_t& val)
+    {
+        return skipDepth > 0 || setValue("string", [&val](const JsonTarget& target) {
+            switch (target.type)
+            {
+                case JsonTarget::Type::Field: return parseFieldElement(val.c_str(), *static_cast<ethsnarks::FieldT*>(target.ptr));
+                case JsonTarget::Type::Limb: return parseBigInt(val.c_str(), *static_cast<ethsnarks::LimbT*>(target.ptr));
+                case JsonTarget::Type::Skip: return true;
+                default: return false;
+            }
+        });
+    }
+
+    bool start_object(std::size_t elements)
+    {
+        return startContainer(false, "object");
+    }
+
+    bool key(json::string_t& val)
+    {
+        if (skipDepth > 0)
+        {
+            return true;
+        }
+        Frame& frame = stack.back();
+        frame.key = val;
+        frame.pending = JsonTarget();
+        unsigned int index = 0;
+        if (frame.target.member(frame.target.ptr, val, frame.pending, index))
+        {
+            if (index >= frame.seen.size())
+            {
+                frame.seen.resize(index + 1, false);
+            }
+            if (frame.seen[index])
+            {
+                return fail("duplicate member");
+            }
+            frame.seen[index] = true;
+            frame.numMembers++;
+        }
+        return true;
+    }
+
+    bool end_object()
+    {
+        if (skipDepth > 0)
+        {
+            skipDepth--;
+            return true;
+        }
+        if (stack.back().numMembers < stack.back().target.numMembers)
+        {
+            stack.back().key.clear();
+            return fail("missing members (" + std::to_string(stack.back().numMembers) + "/" + std::to_string(stack.back().target.numMembers) + ")");
+        }
+        stack.pop_back();
+        return valueDone();
+    }
+
+    bool start_array(std::size_t elements)
+    {
+        return startContainer(true, "array");
+    }
+
+    bool end_array()
+    {
+        if (skipDepth > 0)
+        {
+            skipDepth--;
+            return true;
+        }
+        stack.pop_back();
+        return valueDone();
+    }
+
+    bool parse_error(std::size_t position, const std::string& lastToken, const json::exception& ex)
+    {
+        error = (basePath.length() != 0 ? basePath + ": " : "") + ex.what();
+        return false;
+    }
+
+    // True when parsing was stopped because all members of the root object were read
+    bool isComplete() const
+    {
+        return complete;
+    }
+
+    const std::string& getError() const
+    {
+        return error;
+    }
+
+private:
+
+    struct Frame
+    {
+        JsonTarget target;
+        // Object: the target of the value of the current member
+        JsonTarget pending;
+        bool isArray;
+        std::string key;
+        // Object: the members that were read (by index) and how many
+        std::vector<bool> seen;
+        unsigned int numMembers;
+        unsigned int numElements;
+    };
+
+    static bool setUnsigned(const JsonTarget& target, json::number_unsigned_t val)
+    {
+        switch (target.type)
+        {
+            case JsonTarget::Type::Field: *static_cast<ethsnarks::FieldT*>(target.ptr) = ethsnarks::FieldT(long(val)); return true;
+            case JsonTarget::Type::UInt: *static_cast<unsigned int*>(target.ptr) = (unsigned int)(val); return true;
+            default: return false;
+        }
+    }
+
+    // Returns the target of the next value
+    JsonTarget nextTarget()
+    {
+        if (stack.empty())
+        {
+            return root;
+        }
+        Frame& frame = stack.back();
+        if (frame.isArray)
+        {
+            JsonTarget target;
+            frame.target.element(frame.target.ptr, target);
+            frame.numElements++;
+            return target;
+        }
+        return frame.pending;
+    }
+
+    template<typename F>
+    bool setValue(const char* type, const F& set)
+    {
+        if (!set(nextTarget()))
+        {
+            return fail(std::string("unexpected ") + type);
+        }
+        return valueDone();
+    }
+
+    bool startContainer(bool isArray, const char* name)
+    {
+        if (skipDepth > 0)
+        {
+            skipDepth++;
+            return true;
+        }
+        JsonTarget target = nextTarget();
+        if (target.type == JsonTarget::Type::Skip)
+        {
+            skipDepth = 1;
+            return true;
+        }
+        if (target.type != JsonTarget::Type::Container || (isArray ? target.element == nullptr : target.member == nullptr))
+        {
+            return fail(std::string("unexpected ") + name);
+        }
+        Frame frame;
+        frame.target = target;
+        frame.isArray = isArray;
+        frame.numMembers = 0;
+        frame.numElements = 0;
+        if (!isArray)
+        {
+            frame.seen.resize(target.numMembers, false);
+        }
+        stack.push_back(frame);
+        return true;
+    }
+
+    bool valueDone()
+    {
+        if (stopWhenComplete && stack.size() == 1 && stack[0].numMembers == stack[0].target.numMembers)
+        {
+            complete = true;
+            return false;
+        }
+        return true;
+    }
+
+    bool fail(const std::string& message)
+    {
+        // Path to the value, e.g. ringSettlements[2].ring.orderA
+        std::string path = basePath;
+        for (const Frame& frame : stack)
+        {
+            if (frame.isArray)
+            {
+                path += "[" + std::to_string(frame.numElements - 1) + "]";
+            }
+            else if (frame.key.length() != 0)
+            {
+                path += (path.length() != 0 ? "." : "") + frame.key;
+            }
+        }
+        error = (path.length() != 0 ? path : "block") + ": " + message;
+        return false;
+    }
+
+    JsonTarget root;
+    bool stopWhenComplete;
+    std::string basePath;
+    std::vector<Frame> stack;
+    unsigned int skipDepth;
+    bool complete;
+    std::string error;
+};
+
+static bool parseJsonBlock(const char* data, size_t size, const JsonTarget& target, bool stopWhenComplete, std::string& error,
+                           const std::string& basePath = "")
+{
+    JsonBlockParser parser(target, stopWhenComplete, basePath);
+    bool ok = json::sax_parse(data, data + size, &parser);
+    error = parser.getError();
+    return ok || parser.isComplete();
+}
+
+// Returns the index after the string starting at 'i'
+static size_t skipJsonString(const char* data, size_t size, size_t i)
+{
+    for (i++; i < size; i++)
+    {
+        if (data[i] == '\\')
+        {
+            i++;
+        }
+        else if (data[i] == '"')
+        {
+            return i + 1;
+        }
+    }
+    return size;
+}
+
+// Location of an array in the root object and of its elements
+struct JsonArraySpan
+{
+    size_t begin;
+    size_t end;
+    std::vector<std::pair<size_t, size_t>> elements;
+};
+
+// Finds the elements of the array at 'begin' by only looking at the structure of the JSON
+static bool findJsonArrayElements(const char* data, size_t size, size_t begin, JsonArraySpan& span)
+{
+    span.begin = begin;
+    span.elements.clear();
+    unsigned int depth = 0;
+    size_t elementBegin = size;
+    for (size_t i = begin; i < size; i++)
+    {
+        char c = data[i];
+        bool isSpace = (c == ' ' || c == '\n' || c == '\r' || c == '\t');
+        if (depth == 1 && elementBegin == size && !isSpace && c != ',' && c != ']')
+        {
+            elementBegin = i;
+        }
+        if (c == '"')
+        {
+            i = skipJsonString(data, size, i) - 1;
+        }
+        else if (c == '{' || c == '[')
+        {
+            depth++;
+        }
+        else if ((c == ',' && depth == 1) || ((c == '}' || c == ']') && --depth == 0))
+        {
+            if (elementBegin != size)
+            {
+                span.elements.emplace_back(elementBegin, i);
+            }
+            else if (c == ',')
+            {
+                return false;
+            }
+            elementBegin = size;
+            if (depth == 0)
+            {
+                span.end = i + 1;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// Finds the array that is the value of member 'key' of the root object
+static bool findJsonArray(const char* data, size_t size, const std::string& key, JsonArraySpan& span)
+{
+    unsigned int depth = 0;
+    bool isKey = false;
+    for (size_t i = 0; i < size; i++)
+    {
+        char c = data[i];
+        if (c == '"')
+        {
+            size_t end = skipJsonString(data, size, i);
+            if (isKey && end - i - 2 == key.length() && memcmp(data + i + 1, key.data(), key.length()) == 0)
+            {
+                size_t value = end;
+                while (value < size && (data[value] == ':' || data[value] == ' ' || data[value] == '\n' || data[value] == '\r' || data[value] == '\t'))
+                {
+                    value++;
+                }
+                return value < size && data[value] == '[' && findJsonArrayElements(data, size, value, span);
+            }
+            isKey = false;
+            i = end - 1;
+        }
+        else if (c == '{' || c == '[')
+        {
+            isKey = (++depth == 1);
+        }
+        else if (c == '}' || c == ']')
+        {
+            depth--;
+        }
+        else if (c == ',')
+        {
+            isKey = (depth == 1);
+        }
+    }
+    return false;
+}
+
+/**
+* Parses the list of transactions of a block (rings, deposits, ...) in parallel. The
+* transactions are independent of each other, so each one is parsed separately after
+* finding where they are in the file. The rest of the block is parsed with the list
+* left out (which is small compared to the transactions).
+*/
+class JsonEntriesParser
+{
+public:
+    JsonEntriesParser(const char* _data, size_t _size) :
+        data(_data),
+        size(_size),
+        found(false)
+    {
+
+    }
+
+    template<typename T>
+    void operator()(const char* name, std::vector<T>& entries)
+    {
+        JsonArraySpan span;
+        if (!findJsonArray(data, size, name, span))
+        {
+            // Parsed together with the rest of the block
+            return;
+        }
+        found = true;
+
+        entries.resize(span.elements.size());
+        std::vector<std::string> errors(entries.size());
+#ifdef MULTICORE
+        #pragma omp parallel for
+#endif
+        for (unsigned int i = 0; i < entries.size(); i++)
+        {
+            const std::pair<size_t, size_t>& element = span.elements[i];
+            std::string path = std::string(name) + "[" + std::to_string(i) + "]";
+            if (!parseJsonBlock(data + element.first, element.second - element.first, jsonTarget(entries[i]), false, errors[i], path))
+            {
+                errors[i] = errors[i].length() != 0 ? errors[i] : path + ": invalid";
+            }
+        }
+        for (const std::string& entryError : errors)
+        {
+            if (entryError.length() != 0)
+            {
+                error = entryError;
+                break;
+            }
+        }
+
+        // The rest of the block with an empty list
+        rest.reserve(size - (span.end - span.begin) + 2);
+        rest.assign(data, span.begin);
+        rest += "[]";
+        rest.append(data + span.end, size - span.end);
+    }
+
+    const char* data;
+    size_t size;
+    bool found;
+    std::string rest;
+    std::string error;
+};
+
+template<typename Visitor>
+static void jsonEntries(Visitor& v, RingSettlementBlock& block)
+{
+    v("ringSettlements", block.ringSettlements);
+}
+
+template<typename Visitor>
+static void jsonEntries(Visitor& v, DepositBlock& block)
+{
+    v("deposits", block.deposits);
+}
+
+template<typename Visitor>
+static void jsonEntries(Visitor& v, OnchainWithdrawalBlock& block)
+{
+    v("withdrawals", block.withdrawals);
+}
+
+template<typename Visitor>
+static void jsonEntries(Visitor& v, OffchainWithdrawalBlock& block)
+{
+    v("withdrawals", block.withdrawals);
+}
+
+template<typename Visitor>
+static void jsonEntries(Visitor& v, InternalTransferBlock& block)
+{
+    v("transfers", block.transfers);
+}
+
+/**
+* A JSON block. Only the meta data is parsed when the file is opened, the block
+* itself is parsed when it is read.
+*/
+class JsonBlock : public BlockFile
+{
+public:
+    bool open(const std::string& filename)
+    {
+        if (!file.open(filename, false))
+        {
+            return false;
+        }
+        std::string error;
+        if (!parseJsonBlock(reinterpret_cast<const char*>(file.data), file.size, jsonTarget(meta), true, error))
+        {
+            std::cerr << "Invalid block " << filename << ": " << error << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    BlockType getBlockType() const override
+    {
+        return BlockType(meta.blockType);
+    }
+
+    unsigned int getBlockSize() const override
+    {
+        return meta.blockSize;
+    }
+
+    bool getOnchainDataAvailability() const override
+    {
+        return meta.onchainDataAvailability;
+    }
+
+    // Parses the block to hash it
+    std::string getHash() const override
+    {
+        return hashBlock(*this);
+    }
+
+    bool read(RingSettlementBlock& block) const override
+    {
+        return readBlock(block);
+    }
+
+    bool read(DepositBlock& block) const override
+    {
+        return readBlock(block);
+    }
+
+    bool read(OnchainWithdrawalBlock& block) const override
+    {
+        return readBlock(block);
+    }
+
+    bool read(OffchainWithdrawalBlock& block) const override
+    {
+        return readBlock(block);
+    }
+
+    bool read(InternalTransferBlock& block) const override
+    {
+        return readBlock(block);
+    }
+
+private:
+
+    template<typename BlockT>
+    bool readBlock(BlockT& block) const
+    {
+        const char* data = reinterpret_cast<const char*>(file.data);
+        JsonEntriesParser entriesParser(data, file.size);
+        jsonEntries(entriesParser, block);
+
+        std::string error = entriesParser.error;
+        bool ok = error.length() == 0 && (entriesParser.found ?
+            parseJsonBlock(entriesParser.rest.data(), entriesParser.rest.size(), jsonTarget(block), false, error) :
+            parseJsonBlock(data, file.size, jsonTarget(block), false, error)) &&
+            resolveProofs(block, error);
+        if (!ok)
+        {
+            std::cerr << "Invalid block: " << error << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    MappedFile file;
+    BlockMeta meta;
+};
+
+// Members shared by the block types (with the same type in every block)
+struct BlockCommon
+{
+    ethsnarks::FieldT exchangeID;
+    ethsnarks::FieldT merkleRootBefore;
+    ethsnarks::FieldT merkleRootAfter;
+    ethsnarks::FieldT timestamp;
+    ethsnarks::FieldT protocolTakerFeeBips;
+    ethsnarks::FieldT protocolMakerFeeBips;
+    Signature signature;
+    AccountUpdate accountUpdate_P;
+    ethsnarks::FieldT operatorAccountID;
+    AccountUpdate accountUpdate_O;
+    ethsnarks::LimbT startHash;
+    ethsnarks::FieldT startIndex;
+    ethsnarks::FieldT count;
+};
+
+template<typename Visitor>
+static void jsonFields(Visitor& v, BlockCommon& common)
+{
+    v("exchangeID", common.exchangeID);
+    v("merkleRootBefore", common.merkleRootBefore);
+    v("merkleRootAfter", common.merkleRootAfter);
+    v("timestamp", common.timestamp);
+    v("protocolTakerFeeBips", common.protocolTakerFeeBips);
+    v("protocolMakerFeeBips", common.protocolMakerFeeBips);
+    v("signature", common.signature);
+    v("accountUpdate_P", common.accountUpdate_P);
+    v("operatorAccountID", common.operatorAccountID);
+    v("accountUpdate_O", common.accountUpdate_O);
+    v("startHash", common.startHash);
+    v("startIndex", common.startIndex);
+    v("count", common.count);
+}
+
+// Moves the member 'name' of type T (if it exists) out of the visited object
+template<typename T>
+class JsonMemberMover
+{
+public:
+    JsonMemberMover(const std::string& _name, T& _target) :
+        name(_name),
+        target(_target),
+        moved(false)
+    {
+
+    }
+
+    template<typename U>
+    void operator()(const char* memberName, U& value)
+    {
+
+    }
+
+    void operator()(const char* memberName, T& value)
+    {
+        if (!moved && name == memberName)
+        {
+            target = std::move(value);
+            moved = true;
+        }
+    }
+
+    const std::string name;
+    T& target;
+    bool moved;
+};
+
+// Moves the members of 'common' that were read to the block
+class BlockCommonMover
+{
+public:
+    BlockCommonMover(BlockCommon& _common, const std::set<std::string>& _names) :
+        common(_common),
+        names(_names)
+    {
+
+    }
+
+    template<typename T>
+    void operator()(const char* name, T& value)
+    {
+        if (names.count(name) != 0)
+        {
+            JsonMemberMover<T> mover(name, value);
+            jsonFields(mover, common);
+        }
+    }
+
+    BlockCommon& common;
+    const std::set<std::string>& names;
+};
+
+// Checks that all members of a block were read
+class BlockMemberChecker
+{
+public:
+    BlockMemberChecker(const std::map<std::string, unsigned int>& _members) :
+        members(_members)
+    {
+
+    }
+
+    template<typename T>
+    void operator()(const char* name, T& value)
+    {
+        if (members.count(name) == 0 && missing.length() == 0)
+        {
+            missing = name;
+        }
+    }
+
+    const std::map<std::string, unsigned int>& members;
+    std::string missing;
+};
+
+/**
+* A block parsed while it is received (e.g. in the body of a request), so the JSON of
+* the block is never kept in memory.
+*
+* The type of the block is only known once blockType (or the list of transactions) is
+* read, and the members of a JSON object can be in any order. The members read before
+* that are the same for all blocks, they are stored in 'common' and moved to the block
+* once the whole block is read.
+*
+* The block is moved out when it is read, so it can only be read once.
+*/
+class ParsedBlock : public BlockFile
+{
+public:
+    ParsedBlock()
+    {
+        meta.blockType = (unsigned int)(BlockType::COUNT);
+        meta.blockSize = 0;
+        meta.onchainDataAvailability = false;
+        listType = BlockType::COUNT;
+    }
+
+    // Returns the target of a member of the root object of the block
+    bool member(const std::string& key, JsonTarget& target, unsigned int& index)
+    {
+        // Members are numbered in the order they are first read, so repeated members are found by the parser
+        auto it = members.find(key);
+        index = (it != members.end()) ? it->second : (unsigned int)(members.size());
+
+        unsigned int memberIndex = 0;
+        bool found = jsonMember<BlockMeta>(&meta, key, target, memberIndex);
+        if (!found)
+        {
+            BlockType listKeyType = getListType(key);
+            if (listKeyType != BlockType::COUNT && listType == BlockType::COUNT)
+            {
+                listType = listKeyType;
+            }
+            BlockType type = getType();
+            if (type == BlockType::COUNT)
+            {
+                if (key == "withdrawals")
+                {
+                    // Onchain and offchain withdrawals can't be told apart
+                    error = "blockType needs to be before withdrawals";
+                    target = JsonTarget();
+                    found = true;
+                }
+                else
+                {
+                    found = jsonMember<BlockCommon>(&common, key, target, memberIndex);
+                    if (found)
+                    {
+                        deferred.insert(key);
+                    }
+                }
+            }
+            else
+            {
+                found = blockMember(type, key, target);
+            }
+        }
+        if (found && it == members.end())
+        {
+            members[key] = index;
+        }
+        return found;
+    }
+
+    // Reads the whole block from a file, so it can be hashed and then read without parsing the file twice
+    bool load(const BlockFile& blockFile)
+    {
+        meta.blockType = (unsigned int)(blockFile.getBlockType());
+        meta.blockSize = blockFile.getBlockSize();
+        meta.onchainDataAvailability = blockFile.getOnchainDataAvailability();
+        switch (blockFile.getBlockType())
+        {
+            case BlockType::RingSettlement: return loadBlock(blockFile, ringSettlementBlock);
+            case BlockType::Deposit: return loadBlock(blockFile, depositBlock);
+            case BlockType::OnchainWithdrawal: return loadBlock(blockFile, onchainWithdrawalBlock);
+            case BlockType::OffchainWithdrawal: return loadBlock(blockFile, offchainWithdrawalBlock);
+            case BlockType::InternalTransfer: return loadBlock(blockFile, internalTransferBlock);
+            default: return false;
+        }
+    }
+
+    // Checks the block once it is fully parsed
+    bool finish(std::string& _error)
+    {
+        BlockType type = getType();
+        if (error.length() == 0)
+        {
+            if (type == BlockType::COUNT)
+            {
+                error = "missing blockType";
+            }
+            else if (listType != BlockType::COUNT && listType != type)
+            {
+                error = "the list of transactions does not match blockType";
+            }
+            else if (members.count("blockSize") == 0 || members.count("onchainDataAvailability") == 0)
+            {
+                error = "missing block meta data";
+            }
+        }
+        bool ok = (error.length() == 0);
+        switch (type)
+        {
+            case BlockType::RingSettlement: ok = ok && finishBlock(ringSettlementBlock); break;
+            case BlockType::Deposit: ok = ok && finishBlock(depositBlock); break;
+            case BlockType::OnchainWithdrawal: ok = ok && finishBlock(onchainWithdrawalBlock); break;
+            case BlockType::OffchainWithdrawal: ok = ok && finishBlock(offchainWithdrawalBlock); break;
+            case BlockType::InternalTransfer: ok = ok && finishBlock(internalTransferBlock); break;
+            default: ok = false; break;
+        }
+        common = BlockCommon();
+        _error = error;
+        return ok;
+    }
+
+    BlockType getBlockType() const override
+    {
+        return BlockType(meta.blockType);
+    }
+
+    unsigned int getBlockSize() const override
+    {
+        return meta.blockSize;
+    }
+
+    bool getOnchainDataAvailability() const override
+    {
+        return meta.onchainDataAvailability;
+    }
+
+    // Hashed when the block is finished, so also after the block was read
+    std::string getHash() const override
+    {
+        return hash;
+    }
+
+    bool read(RingSettlementBlock& block) const override
+    {
+        return readBlock(ringSettlementBlock, block);
+    }
+
+    bool read(DepositBlock& block) const override
+    {
+        return readBlock(depositBlock, block);
+    }
+
+    bool read(OnchainWithdrawalBlock& block) const override
+    {
+        return readBlock(onchainWithdrawalBlock, block);
+    }
+
+    bool read(OffchainWithdrawalBlock& block) const override
+    {
+        return readBlock(offchainWithdrawalBlock, block);
+    }
+
+    bool read(InternalTransferBlock& block) const override
+    {
+        return readBlock(internalTransferBlock, block);
+    }
+
+private:
+
+    static BlockType getListType(const std::string& key)
+    {
+        if (key == "ringSettlements") return BlockType::RingSettlement;
+        if (key == "deposits") return BlockType::Deposit;
+        if (key == "transfers") return BlockType::InternalTransfer;
+        return BlockType::COUNT;
+    }
+
+    BlockType getType() const
+    {
+        if (meta.blockType < (unsigned int)(BlockType::COUNT))
+        {
+            return BlockType(meta.blockType);
+        }
+        return listType;
+    }
+
+    bool blockMember(BlockType type, const std::string& key, JsonTarget& target)
+    {
+        switch (type)
+        {
+            case BlockType::RingSettlement: return typedMember(ringSettlementBlock, key, target);
+            case BlockType::Deposit: return typedMember(depositBlock, key, target);
+            case BlockType::OnchainWithdrawal: return typedMember(onchainWithdrawalBlock, key, target);
+            case BlockType::OffchainWithdrawal: return typedMember(offchainWithdrawalBlock, key, target);
+            case BlockType::InternalTransfer: return typedMember(internalTransferBlock, key, target);
+            default: return false;
+        }
+    }
+
+    template<typename BlockT>
+    static bool typedMember(std::unique_ptr<BlockT>& block, const std::string& key, JsonTarget& target)
+    {
+        if (!block)
+        {
+            block.reset(new BlockT());
+        }
+        unsigned int index = 0;
+        return jsonMember<BlockT>(block.get(), key, target, index);
+    }
+
+    template<typename BlockT>
+    bool finishBlock(std::unique_ptr<BlockT>& block)
+    {
+        if (!block)
+        {
+            block.reset(new BlockT());
+        }
+        BlockCommonMover mover(common, deferred);
+        jsonFields(mover, *block);
+
+        BlockMemberChecker checker(members);
+        jsonFields(checker, *block);
+        if (checker.missing.length() != 0)
+        {
+            error = "missing member " + checker.missing;
+            return false;
+        }
+        if (!resolveProofs(*block, error))
+        {
+            return false;
+        }
+        hash = hashBlock(BlockType(meta.blockType), meta.blockSize, meta.onchainDataAvailability, *block);
+        return true;
+    }
+
+    template<typename BlockT>
+    bool loadBlock(const BlockFile& blockFile, std::unique_ptr<BlockT>& block)
+    {
+        block.reset(new BlockT());
+        if (!blockFile.read(*block))
+        {
+            block.reset();
+            return false;
+        }
+        hash = hashBlock(BlockType(meta.blockType), meta.blockSize, meta.onchainDataAvailability, *block);
+        return true;
+    }
+
+    template<typename BlockT>
+    bool readBlock(std::unique_ptr<BlockT>& parsed, BlockT& block) const
+    {
+        if (!parsed)
+        {
+            std::cerr << "Block was already read or is not of the requested type!" << std::endl;
+            return false;
+        }
+        block = std::move(*parsed);
+        parsed.reset();
+        return true;
+    }
+
+    BlockMeta meta;
+    BlockCommon common;
+    // Block type of the list of transactions (if it was read before blockType)
+    BlockType listType;
+    // Index of the members that were read, and the members stored in 'common'
+    std::map<std::string, unsigned int> members;
+    std::set<std::string> deferred;
+    std::string hash;
+    std::string error;
+
+    mutable std::unique_ptr<RingSettlementBlock> ringSettlementBlock;
+    mutable std::unique_ptr<DepositBlock> depositBlock;
+    mutable std::unique_ptr<OnchainWithdrawalBlock> onchainWithdrawalBlock;
+    mutable std::unique_ptr<OffchainWithdrawalBlock> offchainWithdrawalBlock;
+    mutable std::unique_ptr<InternalTransferBlock> internalTransferBlock;
+};
+
+static bool jsonParsedBlockMember(void* object, const std::string& key, JsonTarget& target, unsigned int& index)
+{
+    return static_cast<ParsedBlock*>(object)->member(key, target, index);
+}
+
+// The required members depend on the block type, they are checked by ParsedBlock::finish
+static JsonTarget jsonTarget(ParsedBlock& block)
+{
+    JsonTarget target = jsonValueTarget(JsonTarget::Type::Container, &block);
+    target.member = &jsonParsedBlockMember;
+    return target;
+}
+
+// Stream buffer reading the chunks pushed in a queue
+class ChunkStreamBuf : public std::streambuf
+{
+public:
+    ChunkStreamBuf(BoundedQueue<std::string>& _chunks) :
+        chunks(_chunks)
+    {
+
+    }
+
+protected:
+    int_type underflow() override
+    {
+        do
+        {
+            if (!chunks.pop(chunk))
+            {
+                return traits_type::eof();
+            }
+        } while (chunk.empty());
+        setg(&chunk[0], &chunk[0], &chunk[0] + chunk.size());
+        return traits_type::to_int_type(chunk[0]);
+    }
+
+private:
+    BoundedQueue<std::string>& chunks;
+    std::string chunk;
+};
+
+/**
+* Parses a JSON block while it is received in chunks (e.g. the body of a request).
+* The block is parsed on a separate thread, only a few chunks are buffered in between.
+*/
+class JsonBlockReceiver
+{
+public:
+    JsonBlockReceiver() :
+        block(std::make_shared<ParsedBlock>()),
+        chunks(4),
+        buffer(chunks),
+        parsed(false)
+    {
+        parser = std::thread([this]() {
+            std::istream stream(&buffer);
+            JsonBlockParser handler(jsonTarget(*block));
+            try
+            {
+                parsed = json::sax_parse(stream, &handler);
+                error = handler.getError();
+            }
+            catch (const std::exception& e)
+            {
+                error = e.what();
+            }
+            // Stop receiving when the block is invalid
+            chunks.close();
+        });
+    }
+
+    ~JsonBlockReceiver()
+    {
+        chunks.close();
+        if (parser.joinable())
+        {
+            parser.join();
+        }
+    }
+
+    // Returns false when the block can't be parsed anymore
+    bool receive(const char* data, size_t length)
+    {
+        return chunks.push(std::string(data, length));
+    }
+
+    // Waits until the block is parsed. Returns nullptr when the block is invalid.
+    std::shared_ptr<ParsedBlock> finish(std::string& _error)
+    {
+        chunks.close();
+        parser.join();
+        if (!parsed)
+        {
+            _error = (error.length() != 0) ? error : "invalid block";
+            return nullptr;
+        }
+        if (!block->finish(_error))
+        {
+            return nullptr;
+        }
+        return block;
+    }
+
+private:
+    std::shared_ptr<ParsedBlock> block;
+    BoundedQueue<std::string> chunks;
+    ChunkStreamBuf buffer;
+    std::thread parser;
+    bool parsed;
+    std::string error;
+};
+
+}
+
+#endif
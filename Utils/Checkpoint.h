@@ -0,0 +1,121 @@
+#ifndef _CHECKPOINT_H_
+#define _CHECKPOINT_H_
+
+#include "ethsnarks.hpp"
+#include "CircuitCache.h"
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+
+namespace Loopring
+{
+
+/**
+* Checkpoint of a generated witness, so a job interrupted while it is being proven
+* can be resumed without loading the block and generating the witness again.
+*
+* The field elements are stored in their in-memory (Montgomery) representation,
+* so a checkpoint can only be read by the same build on the same architecture.
+*/
+struct WitnessCheckpointHeader
+{
+    char magic[8];
+    uint32_t blockType;
+    uint32_t blockSize;
+    uint32_t onchainDataAvailability;
+    uint32_t fieldSize;
+    uint64_t numValues;
+    uint64_t primaryInputSize;
+    uint64_t auxiliaryInputSize;
+};
+
+static const char* WITNESS_CHECKPOINT_MAGIC = "LRCWIT1";
+
+static bool writeWitnessCheckpoint(const std::string& filename, const CircuitKey& key, const ethsnarks::ProtoboardT& witness)
+{
+    WitnessCheckpointHeader header;
+    memset(&header, 0, sizeof(header));
+    strncpy(header.magic, WITNESS_CHECKPOINT_MAGIC, sizeof(header.magic));
+    header.blockType = uint32_t(key.blockType);
+    header.blockSize = key.blockSize;
+    header.onchainDataAvailability = key.onchainDataAvailability ? 1 : 0;
+    header.fieldSize = sizeof(FieldT);
+    header.numValues = witness.values.size();
+    header.primaryInputSize = witness.constraint_system.primary_input_size;
+    header.auxiliaryInputSize = witness.constraint_system.auxiliary_input_size;
+
+    // Write to a temporary file first so a crash never leaves a partial checkpoint
+    std::string tmpFilename = filename + ".tmp";
+    FILE* file = fopen(tmpFilename.c_str(), "wb");
+    if (file == nullptr)
+    {
+        std::cerr << "Cannot write checkpoint: " << tmpFilename << std::endl;
+        return false;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+              fwrite(witness.values.data(), sizeof(FieldT), witness.values.size(), file) == witness.values.size();
+    ok = (fclose(file) == 0) && ok;
+    if (!ok || std::rename(tmpFilename.c_str(), filename.c_str()) != 0)
+    {
+        std::cerr << "Cannot write checkpoint: " << filename << std::endl;
+        std::remove(tmpFilename.c_str());
+        return false;
+    }
+    return true;
+}
+
+static bool readWitnessCheckpointHeader(FILE* file, WitnessCheckpointHeader& header)
+{
+    return fread(&header, sizeof(header), 1, file) == 1 &&
+           strncmp(header.magic, WITNESS_CHECKPOINT_MAGIC, sizeof(header.magic)) == 0 &&
+           header.fieldSize == sizeof(FieldT);
+}
+
+// Reads the circuit the checkpoint is for
+static bool readWitnessCheckpointKey(const std::string& filename, CircuitKey& key)
+{
+    FILE* file = fopen(filename.c_str(), "rb");
+    if (file == nullptr)
+    {
+        return false;
+    }
+    WitnessCheckpointHeader header;
+    bool ok = readWitnessCheckpointHeader(file, header);
+    fclose(file);
+    if (!ok)
+    {
+        std::cerr << "Invalid checkpoint: " << filename << std::endl;
+        return false;
+    }
+    key = CircuitKey(BlockType(header.blockType), header.blockSize, header.onchainDataAvailability != 0);
+    return true;
+}
+
+// Reads the witness values in 'witness', which needs to be a witness buffer for the same circuit
+static bool readWitnessCheckpoint(const std::string& filename, const CircuitKey& key, ethsnarks::ProtoboardT& witness)
+{
+    FILE* file = fopen(filename.c_str(), "rb");
+    if (file == nullptr)
+    {
+        return false;
+    }
+    WitnessCheckpointHeader header;
+    bool ok = readWitnessCheckpointHeader(file, header) &&
+              CircuitKey(BlockType(header.blockType), header.blockSize, header.onchainDataAvailability != 0) == key &&
+              header.numValues == witness.values.size() &&
+              header.primaryInputSize == witness.constraint_system.primary_input_size &&
+              header.auxiliaryInputSize == witness.constraint_system.auxiliary_input_size &&
+              fread(witness.values.data(), sizeof(FieldT), witness.values.size(), file) == witness.values.size();
+    fclose(file);
+    if (!ok)
+    {
+        std::cerr << "Checkpoint does not match the circuit: " << filename << std::endl;
+    }
+    return ok;
+}
+
+}
+
+#endif
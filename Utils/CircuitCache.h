@@ -0,0 +1,412 @@
+#ifndef _CIRCUITCACHE_H_
+#define _CIRCUITCACHE_H_
+
+#include "ethsnarks.hpp"
+#include "../Circuits/Circuit.h"
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <functional>
+#include <condition_variable>
+#include <algorithm>
+
+using json = nlohmann::json;
+
+
+namespace Loopring
+{
+
+class CircuitKey
+{
+public:
+    BlockType blockType = BlockType::RingSettlement;
+    unsigned int blockSize = 0;
+    bool onchainDataAvailability = false;
+
+    CircuitKey() {}
+
+    CircuitKey(BlockType _blockType, unsigned int _blockSize, bool _onchainDataAvailability) :
+        blockType(_blockType),
+        blockSize(_blockSize),
+        onchainDataAvailability(_onchainDataAvailability)
+    {
+
+    }
+
+    bool operator<(const CircuitKey& other) const
+    {
+        if (blockType != other.blockType) return blockType < other.blockType;
+        if (blockSize != other.blockSize) return blockSize < other.blockSize;
+        return onchainDataAvailability < other.onchainDataAvailability;
+    }
+
+    bool operator==(const CircuitKey& other) const
+    {
+        return !(*this < other) && !(other < *this);
+    }
+
+    std::string toString() const
+    {
+        return std::string("BlockType: ") + std::to_string(int(blockType)) +
+            "; BlockSize: " + std::to_string(blockSize) +
+            "; OnchainDataAvailability: " + (onchainDataAvailability ? "true" : "false");
+    }
+};
+
+// Reads the circuit meta data in a block (or in a manifest entry)
+static void from_json(const json& j, CircuitKey& key)
+{
+    key.blockType = BlockType(j.at("blockType").get<int>());
+    key.blockSize = j.at("blockSize").get<unsigned int>();
+    key.onchainDataAvailability = j.at("onchainDataAvailability").get<bool>();
+}
+
+/**
+* A constructed circuit together with everything needed to prove blocks for it.
+*
+* The witness is generated in pb. Once generated it is moved to the witness buffer,
+* which only holds the values (the constraint system is shared with pb), so the witness
+* of the next block can be generated in pb while the buffer is being proven.
+*/
+class CircuitInstance
+{
+public:
+    CircuitKey key;
+    ethsnarks::ProtoboardT pb;
+    std::unique_ptr<Circuit> circuit;
+    ethsnarks::ProverContextT context;
+
+    // Estimated memory used by this instance (in bytes)
+    size_t memoryUsage = 0;
+
+    void initWitnessBuffer()
+    {
+        witness.values = pb.values;
+        witness.constraint_system.primary_input_size = pb.constraint_system.primary_input_size;
+        witness.constraint_system.auxiliary_input_size = pb.constraint_system.auxiliary_input_size;
+    }
+
+    // Reserves the witness buffer so a witness can be read into it directly (e.g. from a checkpoint).
+    // Waits until the previous witness in the buffer is proven.
+    ethsnarks::ProtoboardT& acquireWitness()
+    {
+        std::unique_lock<std::mutex> lock(witnessMtx);
+        witnessCV.wait(lock, [this]{ return !witnessInUse; });
+        witnessInUse = true;
+        return witness;
+    }
+
+    // Moves the generated witness to the witness buffer.
+    // Waits until the previous witness in the buffer is proven.
+    void storeWitness()
+    {
+        std::swap(pb.values, acquireWitness().values);
+    }
+
+    const ethsnarks::ProtoboardT& getWitness() const
+    {
+        return witness;
+    }
+
+    void releaseWitness()
+    {
+        std::lock_guard<std::mutex> lock(witnessMtx);
+        witnessInUse = false;
+        witnessCV.notify_all();
+    }
+
+private:
+    ethsnarks::ProtoboardT witness;
+    bool witnessInUse = false;
+    std::mutex witnessMtx;
+    std::condition_variable witnessCV;
+};
+
+/**
+* Circuits share their coefficients in libsnark::ConstantStorage, a single vector for the
+* whole process. Constructing a circuit appends to it, which can reallocate the vector
+* while a block is being proven or its witness is being generated. Provers and witness
+* generation hold this lock shared, circuits are only constructed while holding it
+* exclusively. Waiting constructions go first, so they are not starved by new proofs.
+*/
+class ConstructionLock
+{
+public:
+    // Holds the lock shared for its lifetime
+    class Shared
+    {
+    public:
+        Shared(ConstructionLock& _lock) :
+            lock(_lock)
+        {
+            lock.lockShared();
+        }
+
+        ~Shared()
+        {
+            lock.unlockShared();
+        }
+
+    private:
+        ConstructionLock& lock;
+    };
+
+    void lockShared()
+    {
+        std::unique_lock<std::mutex> guard(mtx);
+        cv.wait(guard, [this]{ return !constructing && numWaiting == 0; });
+        numShared++;
+    }
+
+    void unlockShared()
+    {
+        std::lock_guard<std::mutex> guard(mtx);
+        if (--numShared == 0)
+        {
+            cv.notify_all();
+        }
+    }
+
+    void lock()
+    {
+        std::unique_lock<std::mutex> guard(mtx);
+        numWaiting++;
+        cv.wait(guard, [this]{ return !constructing && numShared == 0; });
+        numWaiting--;
+        constructing = true;
+    }
+
+    void unlock()
+    {
+        std::lock_guard<std::mutex> guard(mtx);
+        constructing = false;
+        cv.notify_all();
+    }
+
+private:
+    unsigned int numShared = 0;
+    unsigned int numWaiting = 0;
+    bool constructing = false;
+    std::mutex mtx;
+    std::condition_variable cv;
+};
+
+/**
+* Hosts all circuits listed in a manifest in a single process.
+*
+* Circuits are only constructed (and their proving keys loaded) the first time a block
+* for them is requested. When the memory budget is exceeded the least recently used
+* circuits are dropped. Circuits still in use are kept alive by their shared_ptr until
+* the prover is done with them, their memory is counted against the budget until then.
+* A new circuit that doesn't fit in the budget because of them is only constructed
+* once they are released (see release).
+*/
+class CircuitCache
+{
+public:
+    typedef std::function<bool(CircuitInstance&)> Builder;
+
+    CircuitCache(const std::vector<CircuitKey>& keys, size_t _memoryBudget, Builder _builder) :
+        memoryBudget(_memoryBudget),
+        builder(_builder),
+        useCounter(0)
+    {
+        for (const CircuitKey& key : keys)
+        {
+            entries[key] = Entry();
+        }
+    }
+
+    bool isHosted(const CircuitKey& key) const
+    {
+        return entries.find(key) != entries.end();
+    }
+
+    // Returns the circuit for the key, constructing it first if needed.
+    // Returns nullptr if the circuit is not hosted or could not be constructed.
+    // The circuit is constructed without holding the lock so lookups of other circuits
+    // are not blocked. Concurrent requests for the same circuit wait for the construction.
+    std::shared_ptr<CircuitInstance> acquire(const CircuitKey& key)
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        auto it = entries.find(key);
+        if (it == entries.end())
+        {
+            return nullptr;
+        }
+        Entry& entry = it->second;
+        entry.lastUsed = ++useCounter;
+        builtCV.wait(lock, [&entry]{ return !entry.building; });
+        if (entry.instance)
+        {
+            return entry.instance;
+        }
+
+        // Make room for the new circuit. Circuits dropped from the cache that are still in use
+        // keep their memory until they are released, so wait for that when they don't fit.
+        size_t expected = entry.memoryUsage;
+        for (const auto& other : entries)
+        {
+            expected = std::max(expected, other.second.memoryUsage);
+        }
+        entry.building = true;
+        while (true)
+        {
+            evict(key, expected);
+            if (memoryBudget == 0 || getMemoryUsage() + expected <= memoryBudget || evicted.empty())
+            {
+                break;
+            }
+            std::cout << "Waiting for unloaded circuits to be released..." << std::endl;
+            releasedCV.wait(lock);
+        }
+        entry.reserved = expected;
+        lock.unlock();
+
+        std::cout << "Constructing circuit (" << key.toString() << ")..." << std::endl;
+        std::shared_ptr<CircuitInstance> instance = std::make_shared<CircuitInstance>();
+        instance->key = key;
+        bool built = false;
+        {
+            std::lock_guard<ConstructionLock> constructing(constructionLock);
+            built = builder(*instance);
+        }
+
+        lock.lock();
+        entry.building = false;
+        entry.reserved = 0;
+        if (built)
+        {
+            entry.instance = instance;
+            entry.memoryUsage = instance->memoryUsage;
+            evict(key, 0);
+        }
+        builtCV.notify_all();
+        if (!built)
+        {
+            std::cerr << "Could not construct circuit (" << key.toString() << ")" << std::endl;
+            return nullptr;
+        }
+        return instance;
+    }
+
+    // Drops a reference to a circuit, wakes up constructions waiting for unloaded circuits to be released
+    void release(std::shared_ptr<CircuitInstance>& instance)
+    {
+        instance = nullptr;
+        std::lock_guard<std::mutex> lock(mtx);
+        releasedCV.notify_all();
+    }
+
+    // Held shared while a circuit of the cache is used to prove a block or generate a witness
+    ConstructionLock& getConstructionLock()
+    {
+        return constructionLock;
+    }
+
+    json info() const
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        json jCircuits = json::array();
+        for (const auto& it : entries)
+        {
+            jCircuits.push_back({
+                {"blockType", int(it.first.blockType)},
+                {"blockSize", it.first.blockSize},
+                {"onchainDataAvailability", it.first.onchainDataAvailability},
+                {"loaded", it.second.instance != nullptr},
+                {"building", it.second.building},
+                {"memoryUsageMB", it.second.memoryUsage / (1024 * 1024)}
+            });
+        }
+        return json{{"memoryBudgetMB", memoryBudget / (1024 * 1024)}, {"memoryUsageMB", getMemoryUsage() / (1024 * 1024)},
+                    {"unloadingCircuits", evicted.size()}, {"circuits", jCircuits}};
+    }
+
+private:
+
+    struct Entry
+    {
+        std::shared_ptr<CircuitInstance> instance;
+        size_t memoryUsage = 0;
+        uint64_t lastUsed = 0;
+        // Set while the circuit is constructed (without holding the lock)
+        bool building = false;
+        // Memory reserved for the circuit while it is constructed
+        size_t reserved = 0;
+    };
+
+    // A circuit dropped from the cache that is still used by queued or running jobs
+    struct EvictedInstance
+    {
+        std::weak_ptr<CircuitInstance> instance;
+        size_t memoryUsage;
+    };
+
+    // Includes the circuits being constructed and the dropped circuits that are still in use
+    size_t getMemoryUsage() const
+    {
+        size_t total = 0;
+        for (const auto& it : entries)
+        {
+            if (it.second.instance)
+            {
+                total += it.second.memoryUsage;
+            }
+            total += it.second.reserved;
+        }
+        evicted.erase(std::remove_if(evicted.begin(), evicted.end(), [](const EvictedInstance& e) { return e.instance.expired(); }), evicted.end());
+        for (const EvictedInstance& e : evicted)
+        {
+            total += e.memoryUsage;
+        }
+        return total;
+    }
+
+    // Drops the least recently used circuits (except 'keep') until 'extra' bytes fit in the budget
+    void evict(const CircuitKey& keep, size_t extra)
+    {
+        if (memoryBudget == 0)
+        {
+            return;
+        }
+        while (getMemoryUsage() + extra > memoryBudget)
+        {
+            Entry* lru = nullptr;
+            for (auto& it : entries)
+            {
+                if (it.second.instance && !(it.first == keep) && (lru == nullptr || it.second.lastUsed < lru->lastUsed))
+                {
+                    lru = &it.second;
+                }
+            }
+            if (lru == nullptr)
+            {
+                return;
+            }
+            std::cout << "Unloading circuit (" << lru->instance->key.toString() << ")" << std::endl;
+            // Jobs still holding the circuit keep it alive, keep counting it until they are done
+            if (lru->instance.use_count() > 1)
+            {
+                evicted.push_back(EvictedInstance{lru->instance, lru->memoryUsage});
+            }
+            lru->instance.reset();
+        }
+    }
+
+    const size_t memoryBudget;
+    Builder builder;
+
+    uint64_t useCounter;
+    std::map<CircuitKey, Entry> entries;
+    mutable std::vector<EvictedInstance> evicted;
+    mutable std::mutex mtx;
+    std::condition_variable builtCV;
+    std::condition_variable releasedCV;
+    ConstructionLock constructionLock;
+};
+
+}
+
+#endif
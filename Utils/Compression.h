@@ -0,0 +1,94 @@
+#ifndef _COMPRESSION_H_
+#define _COMPRESSION_H_
+
+#include <string>
+#include <functional>
+
+#ifdef ZSTD_SUPPORT
+#include <zstd.h>
+#endif
+
+
+namespace Loopring
+{
+
+/**
+* Decodes a request body chunk by chunk as it is received.
+*
+* gzip is already decoded by httplib when it's compiled with CPPHTTPLIB_ZLIB_SUPPORT,
+* zstd is decoded here when compiled with ZSTD_SUPPORT.
+*/
+class StreamDecoder
+{
+public:
+    typedef std::function<bool(const char* data, size_t length)> Receiver;
+
+    StreamDecoder(const std::string& _encoding) :
+        encoding(_encoding)
+    {
+#ifdef ZSTD_SUPPORT
+        zstdStream = nullptr;
+        if (encoding == "zstd")
+        {
+            zstdStream = ZSTD_createDStream();
+            ZSTD_initDStream(zstdStream);
+        }
+#endif
+    }
+
+    ~StreamDecoder()
+    {
+#ifdef ZSTD_SUPPORT
+        if (zstdStream != nullptr)
+        {
+            ZSTD_freeDStream(zstdStream);
+        }
+#endif
+    }
+
+    bool isSupported() const
+    {
+#ifdef ZSTD_SUPPORT
+        if (encoding == "zstd")
+        {
+            return true;
+        }
+#endif
+        return encoding.length() == 0 || encoding == "identity";
+    }
+
+    bool decode(const char* data, size_t length, const Receiver& receiver)
+    {
+#ifdef ZSTD_SUPPORT
+        if (zstdStream != nullptr)
+        {
+            char buffer[1 << 16];
+            ZSTD_inBuffer input = {data, length, 0};
+            bool outputFull = true;
+            // Keep going while there's input left or the decoder may still have buffered output
+            while (input.pos < input.size || outputFull)
+            {
+                ZSTD_outBuffer output = {buffer, sizeof(buffer), 0};
+                size_t result = ZSTD_decompressStream(zstdStream, &output, &input);
+                if (ZSTD_isError(result) || !receiver(buffer, output.pos))
+                {
+                    return false;
+                }
+                outputFull = (output.pos == output.size);
+            }
+            return true;
+        }
+#endif
+        return receiver(data, length);
+    }
+
+private:
+    std::string encoding;
+#ifdef ZSTD_SUPPORT
+    ZSTD_DStream* zstdStream;
+#endif
+};
+
+}
+
+#endif
@@ -2,12 +2,18 @@
 #define _DATA_H_
 
 #include "Constants.h"
+#include "FieldParser.h"
 
 //#include "../ThirdParty/json.hpp"
 #include "ethsnarks.hpp"
 #include "jubjub/point.hpp"
 #include "jubjub/eddsa.hpp"
 
+#include <string>
+#include <vector>
+#include <exception>
+#include <stdexcept>
+
 using json = nlohmann::json;
 
 
@@ -26,17 +32,177 @@ enum class BlockType
     COUNT
 };
 
+// Converts the entries of a list in parallel, the entries are independent of each other
+template<typename T>
+static void parallelFromJson(const json& j, std::vector<T>& entries)
+{
+    entries.resize(j.size());
+    // Exceptions cannot leave the parallel loop, the first one is rethrown afterwards
+    std::exception_ptr exception;
+#ifdef MULTICORE
+    #pragma omp parallel for
+#endif
+    for(unsigned int i = 0; i < j.size(); i++)
+    {
+        try
+        {
+            from_json(j[i], entries[i]);
+        }
+        catch (...)
+        {
+#ifdef MULTICORE
+            #pragma omp critical
+#endif
+            if (!exception)
+            {
+                exception = std::current_exception();
+            }
+        }
+    }
+    if (exception)
+    {
+        std::rethrow_exception(exception);
+    }
+}
+
+static const unsigned int NO_BASE_PROOF = 0xFFFFFFFF;
+
+/**
+* A Merkle proof is either a list of all siblings or delta encoded: only the siblings that
+* are different from an earlier proof in the block, e.g.
+*   {"base": 3, "indices": [0, 1], "siblings": ["123", "456"]}
+* where 'base' is the index of the earlier proof. The proofs of a block are numbered from 0
+* in the order of the jsonFields functions (list entries in order). Delta encoded proofs are
+* rebuilt after the whole block is read (see resolveProofs).
+*/
 class Proof
 {
 public:
+    Proof() :
+        base(NO_BASE_PROOF)
+    {
+
+    }
+
     std::vector<ethsnarks::FieldT> data;
+
+    unsigned int base;
+    std::vector<unsigned int> indices;
 };
 
+template<typename Visitor>
+static void jsonFields(Visitor& v, Proof& proof)
+{
+    v("base", proof.base);
+    v("indices", proof.indices);
+    v("siblings", proof.data);
+}
+
 static void from_json(const json& j, Proof& proof)
 {
-    for(unsigned int i = 0; i < j.size(); i++)
+    const json& jSiblings = j.is_object() ? j.at("siblings") : j;
+    if (j.is_object())
+    {
+        proof.base = j.at("base").get<unsigned int>();
+        proof.indices = j.at("indices").get<std::vector<unsigned int>>();
+    }
+    for(unsigned int i = 0; i < jSiblings.size(); i++)
+    {
+        proof.data.push_back(parseFieldElement(jSiblings[i]));
+    }
+}
+
+// Rebuilds the delta encoded proofs of a block, visiting the proofs in order
+class ProofResolver
+{
+public:
+    ProofResolver() :
+        valid(true)
+    {
+
+    }
+
+    void operator()(const char* name, Proof& proof)
+    {
+        if (proof.base != NO_BASE_PROOF && valid)
+        {
+            if (proof.base >= proofs.size() || proof.indices.size() != proof.data.size())
+            {
+                fail(proof, "invalid base proof or number of siblings");
+                return;
+            }
+            std::vector<ethsnarks::FieldT> siblings = proofs[proof.base]->data;
+            for (unsigned int i = 0; i < proof.indices.size(); i++)
+            {
+                if (proof.indices[i] >= siblings.size())
+                {
+                    fail(proof, "invalid sibling index");
+                    return;
+                }
+                siblings[proof.indices[i]] = proof.data[i];
+            }
+            proof.data.swap(siblings);
+            proof.base = NO_BASE_PROOF;
+            proof.indices.clear();
+        }
+        proofs.push_back(&proof);
+    }
+
+    void operator()(const char* name, ethsnarks::FieldT& value)
+    {
+
+    }
+
+    void operator()(const char* name, ethsnarks::LimbT& value)
+    {
+
+    }
+
+    template<typename T>
+    void operator()(const char* name, std::vector<T>& values)
+    {
+        for (T& value : values)
+        {
+            (*this)(name, value);
+        }
+    }
+
+    template<typename T>
+    void operator()(const char* name, T& value)
+    {
+        jsonFields(*this, value);
+    }
+
+    std::vector<const Proof*> proofs;
+    bool valid;
+    std::string error;
+
+private:
+
+    void fail(const Proof& proof, const std::string& message)
     {
-        proof.data.push_back(ethsnarks::FieldT(j[i].get<std::string>().c_str()));
+        error = "proof " + std::to_string(proofs.size()) + " (base " + std::to_string(proof.base) + "): " + message;
+        valid = false;
+    }
+};
+
+template<typename BlockT>
+static bool resolveProofs(BlockT& block, std::string& error)
+{
+    ProofResolver resolver;
+    jsonFields(resolver, block);
+    error = resolver.error;
+    return resolver.valid;
+}
+
+// Throws like the json conversions do
+template<typename BlockT>
+static void resolveProofs(BlockT& block)
+{
+    std::string error;
+    if (!resolveProofs(block, error))
+    {
+        throw std::invalid_argument(error);
     }
 }
 
@@ -47,10 +213,17 @@ public:
     ethsnarks::FieldT orderID;
 };
 
+template<typename Visitor>
+static void jsonFields(Visitor& v, TradeHistoryLeaf& leaf)
+{
+    v("filled", leaf.filled);
+    v("orderID", leaf.orderID);
+}
+
 static void from_json(const json& j, TradeHistoryLeaf& leaf)
 {
-    leaf.filled = ethsnarks::FieldT(j.at("filled").get<std::string>().c_str());
-    leaf.orderID = ethsnarks::FieldT(j.at("orderID").get<std::string>().c_str());
+    leaf.filled = parseFieldElement(j.at("filled"));
+    leaf.orderID = parseFieldElement(j.at("orderID"));
 }
 
 class BalanceLeaf
@@ -60,10 +233,17 @@ public:
     ethsnarks::FieldT tradingHistoryRoot;
 };
 
+template<typename Visitor>
+static void jsonFields(Visitor& v, BalanceLeaf& leaf)
+{
+    v("balance", leaf.balance);
+    v("tradingHistoryRoot", leaf.tradingHistoryRoot);
+}
+
 static void from_json(const json& j, BalanceLeaf& leaf)
 {
-    leaf.balance = ethsnarks::FieldT(j.at("balance").get<std::string>().c_str());
-    leaf.tradingHistoryRoot = ethsnarks::FieldT(j.at("tradingHistoryRoot").get<std::string>().c_str());
+    leaf.balance = parseFieldElement(j.at("balance"));
+    leaf.tradingHistoryRoot = parseFieldElement(j.at("tradingHistoryRoot"));
 }
 
 class Account
@@ -74,12 +254,21 @@ public:
     ethsnarks::FieldT balancesRoot;
 };
 
+template<typename Visitor>
+static void jsonFields(Visitor& v, Account& account)
+{
+    v("publicKeyX", account.publicKey.x);
+    v("publicKeyY", account.publicKey.y);
+    v("nonce", account.nonce);
+    v("balancesRoot", account.balancesRoot);
+}
+
 static void from_json(const json& j, Account& account)
 {
-    account.publicKey.x = ethsnarks::FieldT(j.at("publicKeyX").get<std::string>().c_str());
-    account.publicKey.y = ethsnarks::FieldT(j.at("publicKeyY").get<std::string>().c_str());
+    account.publicKey.x = parseFieldElement(j.at("publicKeyX"));
+    account.publicKey.y = parseFieldElement(j.at("publicKeyY"));
     account.nonce = ethsnarks::FieldT(j.at("nonce"));
-    account.balancesRoot = ethsnarks::FieldT(j.at("balancesRoot").get<std::string>().c_str());
+    account.balancesRoot = parseFieldElement(j.at("balancesRoot"));
 }
 
 class BalanceUpdate
@@ -93,12 +282,23 @@ public:
     BalanceLeaf after;
 };
 
+template<typename Visitor>
+static void jsonFields(Visitor& v, BalanceUpdate& balanceUpdate)
+{
+    v("tokenID", balanceUpdate.tokenID);
+    v("proof", balanceUpdate.proof);
+    v("rootBefore", balanceUpdate.rootBefore);
+    v("rootAfter", balanceUpdate.rootAfter);
+    v("before", balanceUpdate.before);
+    v("after", balanceUpdate.after);
+}
+
 static void from_json(const json& j, BalanceUpdate& balanceUpdate)
 {
     balanceUpdate.tokenID = ethsnarks::FieldT(j.at("tokenID"));
     balanceUpdate.proof = j.at("proof").get<Proof>();
-    balanceUpdate.rootBefore = ethsnarks::FieldT(j.at("rootBefore").get<std::string>().c_str());
-    balanceUpdate.rootAfter = ethsnarks::FieldT(j.at("rootAfter").get<std::string>().c_str());
+    balanceUpdate.rootBefore = parseFieldElement(j.at("rootBefore"));
+    balanceUpdate.rootAfter = parseFieldElement(j.at("rootAfter"));
     balanceUpdate.before = j.at("before").get<BalanceLeaf>();
     balanceUpdate.after = j.at("after").get<BalanceLeaf>();
 }
@@ -114,12 +314,23 @@ public:
     TradeHistoryLeaf after;
 };
 
+template<typename Visitor>
+static void jsonFields(Visitor& v, TradeHistoryUpdate& tradeHistoryUpdate)
+{
+    v("orderID", tradeHistoryUpdate.orderID);
+    v("proof", tradeHistoryUpdate.proof);
+    v("rootBefore", tradeHistoryUpdate.rootBefore);
+    v("rootAfter", tradeHistoryUpdate.rootAfter);
+    v("before", tradeHistoryUpdate.before);
+    v("after", tradeHistoryUpdate.after);
+}
+
 static void from_json(const json& j, TradeHistoryUpdate& tradeHistoryUpdate)
 {
-    tradeHistoryUpdate.orderID = ethsnarks::FieldT(j.at("orderID").get<std::string>().c_str());
+    tradeHistoryUpdate.orderID = parseFieldElement(j.at("orderID"));
     tradeHistoryUpdate.proof = j.at("proof").get<Proof>();
-    tradeHistoryUpdate.rootBefore = ethsnarks::FieldT(j.at("rootBefore").get<std::string>().c_str());
-    tradeHistoryUpdate.rootAfter = ethsnarks::FieldT(j.at("rootAfter").get<std::string>().c_str());
+    tradeHistoryUpdate.rootBefore = parseFieldElement(j.at("rootBefore"));
+    tradeHistoryUpdate.rootAfter = parseFieldElement(j.at("rootAfter"));
     tradeHistoryUpdate.before = j.at("before").get<TradeHistoryLeaf>();
     tradeHistoryUpdate.after = j.at("after").get<TradeHistoryLeaf>();
 }
@@ -135,12 +346,23 @@ public:
     Account after;
 };
 
+template<typename Visitor>
+static void jsonFields(Visitor& v, AccountUpdate& accountUpdate)
+{
+    v("accountID", accountUpdate.accountID);
+    v("proof", accountUpdate.proof);
+    v("rootBefore", accountUpdate.rootBefore);
+    v("rootAfter", accountUpdate.rootAfter);
+    v("before", accountUpdate.before);
+    v("after", accountUpdate.after);
+}
+
 static void from_json(const json& j, AccountUpdate& accountUpdate)
 {
     accountUpdate.accountID = ethsnarks::FieldT(j.at("accountID"));
     accountUpdate.proof = j.at("proof").get<Proof>();
-    accountUpdate.rootBefore = ethsnarks::FieldT(j.at("rootBefore").get<std::string>().c_str());
-    accountUpdate.rootAfter = ethsnarks::FieldT(j.at("rootAfter").get<std::string>().c_str());
+    accountUpdate.rootBefore = parseFieldElement(j.at("rootBefore"));
+    accountUpdate.rootAfter = parseFieldElement(j.at("rootAfter"));
     accountUpdate.before = j.at("before").get<Account>();
     accountUpdate.after = j.at("after").get<Account>();
 }
@@ -163,11 +385,19 @@ public:
     ethsnarks::FieldT s;
 };
 
+template<typename Visitor>
+static void jsonFields(Visitor& v, Signature& signature)
+{
+    v("Rx", signature.R.x);
+    v("Ry", signature.R.y);
+    v("s", signature.s);
+}
+
 static void from_json(const json& j, Signature& signature)
 {
-    signature.R.x = ethsnarks::FieldT(j.at("Rx").get<std::string>().c_str());
-    signature.R.y = ethsnarks::FieldT(j.at("Ry").get<std::string>().c_str());
-    signature.s = ethsnarks::FieldT(j.at("s").get<std::string>().c_str());
+    signature.R.x = parseFieldElement(j.at("Rx"));
+    signature.R.y = parseFieldElement(j.at("Ry"));
+    signature.s = parseFieldElement(j.at("s"));
 }
 
 class Order
@@ -192,15 +422,37 @@ public:
     Signature signature;
 };
 
+template<typename Visitor>
+static void jsonFields(Visitor& v, Order& order)
+{
+    v("exchangeID", order.exchangeID);
+    v("orderID", order.orderID);
+    v("accountID", order.accountID);
+    v("tokenS", order.tokenS);
+    v("tokenB", order.tokenB);
+    v("amountS", order.amountS);
+    v("amountB", order.amountB);
+    v("allOrNone", order.allOrNone);
+    v("validSince", order.validSince);
+    v("validUntil", order.validUntil);
+    v("maxFeeBips", order.maxFeeBips);
+    v("buy", order.buy);
+
+    v("feeBips", order.feeBips);
+    v("rebateBips", order.rebateBips);
+
+    v("signature", order.signature);
+}
+
 static void from_json(const json& j, Order& order)
 {
     order.exchangeID = ethsnarks::FieldT(j.at("exchangeID"));
-    order.orderID = ethsnarks::FieldT(j.at("orderID").get<std::string>().c_str());
+    order.orderID = parseFieldElement(j.at("orderID"));
     order.accountID = ethsnarks::FieldT(j.at("accountID"));
     order.tokenS = ethsnarks::FieldT(j.at("tokenS"));
     order.tokenB = ethsnarks::FieldT(j.at("tokenB"));
-    order.amountS = ethsnarks::FieldT(j.at("amountS").get<std::string>().c_str());
-    order.amountB = ethsnarks::FieldT(j.at("amountB").get<std::string>().c_str());
+    order.amountS = parseFieldElement(j.at("amountS"));
+    order.amountB = parseFieldElement(j.at("amountB"));
     order.allOrNone = ethsnarks::FieldT(j.at("allOrNone").get<bool>() ? 1 : 0);
     order.validSince = ethsnarks::FieldT(j.at("validSince"));
     order.validUntil = ethsnarks::FieldT(j.at("validUntil"));
@@ -222,6 +474,15 @@ public:
     ethsnarks::FieldT fillS_B;
 };
 
+template<typename Visitor>
+static void jsonFields(Visitor& v, Ring& ring)
+{
+    v("orderA", ring.orderA);
+    v("orderB", ring.orderB);
+    v("fFillS_A", ring.fillS_A);
+    v("fFillS_B", ring.fillS_B);
+}
+
 static void from_json(const json& j, Ring& ring)
 {
     ring.orderA = j.at("orderA").get<Order>();
@@ -255,11 +516,36 @@ public:
     BalanceUpdate balanceUpdateB_O;
 };
 
+template<typename Visitor>
+static void jsonFields(Visitor& v, RingSettlement& ringSettlement)
+{
+    v("ring", ringSettlement.ring);
+
+    v("accountsMerkleRoot", ringSettlement.accountsMerkleRoot);
+
+    v("tradeHistoryUpdate_A", ringSettlement.tradeHistoryUpdate_A);
+    v("tradeHistoryUpdate_B", ringSettlement.tradeHistoryUpdate_B);
+
+    v("balanceUpdateS_A", ringSettlement.balanceUpdateS_A);
+    v("balanceUpdateB_A", ringSettlement.balanceUpdateB_A);
+    v("accountUpdate_A", ringSettlement.accountUpdate_A);
+
+    v("balanceUpdateS_B", ringSettlement.balanceUpdateS_B);
+    v("balanceUpdateB_B", ringSettlement.balanceUpdateB_B);
+    v("accountUpdate_B", ringSettlement.accountUpdate_B);
+
+    v("balanceUpdateA_P", ringSettlement.balanceUpdateA_P);
+    v("balanceUpdateB_P", ringSettlement.balanceUpdateB_P);
+
+    v("balanceUpdateA_O", ringSettlement.balanceUpdateA_O);
+    v("balanceUpdateB_O", ringSettlement.balanceUpdateB_O);
+}
+
 static void from_json(const json& j, RingSettlement& ringSettlement)
 {
     ringSettlement.ring = j.at("ring").get<Ring>();
 
-    ringSettlement.accountsMerkleRoot = ethsnarks::FieldT(j.at("accountsMerkleRoot").get<std::string>().c_str());
+    ringSettlement.accountsMerkleRoot = parseFieldElement(j.at("accountsMerkleRoot"));
 
     ringSettlement.tradeHistoryUpdate_A = j.at("tradeHistoryUpdate_A").get<TradeHistoryUpdate>();
     ringSettlement.tradeHistoryUpdate_B = j.at("tradeHistoryUpdate_B").get<TradeHistoryUpdate>();
@@ -303,12 +589,35 @@ public:
     std::vector<Loopring::RingSettlement> ringSettlements;
 };
 
+template<typename Visitor>
+static void jsonFields(Visitor& v, RingSettlementBlock& block)
+{
+    v("exchangeID", block.exchangeID);
+
+    v("merkleRootBefore", block.merkleRootBefore);
+    v("merkleRootAfter", block.merkleRootAfter);
+
+    v("timestamp", block.timestamp);
+
+    v("protocolTakerFeeBips", block.protocolTakerFeeBips);
+    v("protocolMakerFeeBips", block.protocolMakerFeeBips);
+
+    v("signature", block.signature);
+
+    v("accountUpdate_P", block.accountUpdate_P);
+
+    v("operatorAccountID", block.operatorAccountID);
+    v("accountUpdate_O", block.accountUpdate_O);
+
+    v("ringSettlements", block.ringSettlements);
+}
+
 static void from_json(const json& j, RingSettlementBlock& block)
 {
     block.exchangeID = ethsnarks::FieldT(j["exchangeID"].get<unsigned int>());
 
-    block.merkleRootBefore = ethsnarks::FieldT(j["merkleRootBefore"].get<std::string>().c_str());
-    block.merkleRootAfter = ethsnarks::FieldT(j["merkleRootAfter"].get<std::string>().c_str());
+    block.merkleRootBefore = parseFieldElement(j["merkleRootBefore"]);
+    block.merkleRootAfter = parseFieldElement(j["merkleRootAfter"]);
 
     block.timestamp = ethsnarks::FieldT(j["timestamp"].get<unsigned int>());
 
@@ -323,11 +632,9 @@ static void from_json(const json& j, RingSettlementBlock& block)
     block.accountUpdate_O = j.at("accountUpdate_O").get<AccountUpdate>();
 
     // Read settlements
-    json jRingSettlements = j["ringSettlements"];
-    for(unsigned int i = 0; i < jRingSettlements.size(); i++)
-    {
-        block.ringSettlements.emplace_back(jRingSettlements[i].get<Loopring::RingSettlement>());
-    }
+    parallelFromJson(j["ringSettlements"], block.ringSettlements);
+
+    resolveProofs(block);
 }
 
 class Deposit
@@ -338,9 +645,17 @@ public:
     AccountUpdate accountUpdate;
 };
 
+template<typename Visitor>
+static void jsonFields(Visitor& v, Deposit& deposit)
+{
+    v("amount", deposit.amount);
+    v("balanceUpdate", deposit.balanceUpdate);
+    v("accountUpdate", deposit.accountUpdate);
+}
+
 static void from_json(const json& j, Deposit& deposit)
 {
-    deposit.amount = ethsnarks::FieldT(j.at("amount").get<std::string>().c_str());
+    deposit.amount = parseFieldElement(j.at("amount"));
     deposit.balanceUpdate = j.at("balanceUpdate").get<BalanceUpdate>();
     deposit.accountUpdate = j.at("accountUpdate").get<AccountUpdate>();
 }
@@ -361,24 +676,38 @@ public:
     std::vector<Loopring::Deposit> deposits;
 };
 
+template<typename Visitor>
+static void jsonFields(Visitor& v, DepositBlock& block)
+{
+    v("exchangeID", block.exchangeID);
+
+    v("merkleRootBefore", block.merkleRootBefore);
+    v("merkleRootAfter", block.merkleRootAfter);
+
+    v("startHash", block.startHash);
+
+    v("startIndex", block.startIndex);
+    v("count", block.count);
+
+    v("deposits", block.deposits);
+}
+
 static void from_json(const json& j, DepositBlock& block)
 {
     block.exchangeID = ethsnarks::FieldT(j["exchangeID"].get<unsigned int>());
 
-    block.merkleRootBefore = ethsnarks::FieldT(j["merkleRootBefore"].get<std::string>().c_str());
-    block.merkleRootAfter = ethsnarks::FieldT(j["merkleRootAfter"].get<std::string>().c_str());
+    block.merkleRootBefore = parseFieldElement(j["merkleRootBefore"]);
+    block.merkleRootAfter = parseFieldElement(j["merkleRootAfter"]);
 
-    block.startHash = ethsnarks::LimbT(j["startHash"].get<std::string>().c_str());
+    block.startHash = parseBigInt(j["startHash"]);
 
-    block.startIndex = ethsnarks::FieldT(j["startIndex"].get<std::string>().c_str());
-    block.count = ethsnarks::FieldT(j["count"].get<std::string>().c_str());
+    block.startIndex = parseFieldElement(j["startIndex"]);
+    block.count = parseFieldElement(j["count"]);
 
     // Read deposits
-    json jDeposits = j["deposits"];
-    for(unsigned int i = 0; i < jDeposits.size(); i++)
-    {
-        block.deposits.emplace_back(jDeposits[i].get<Loopring::Deposit>());
-    }
+    parallelFromJson(j["deposits"], block.deposits);
+
+    resolveProofs(block);
 }
 
 class OnchainWithdrawal
@@ -389,9 +718,17 @@ public:
     AccountUpdate accountUpdate;
 };
 
+template<typename Visitor>
+static void jsonFields(Visitor& v, OnchainWithdrawal& withdrawal)
+{
+    v("amountRequested", withdrawal.amountRequested);
+    v("balanceUpdate", withdrawal.balanceUpdate);
+    v("accountUpdate", withdrawal.accountUpdate);
+}
+
 static void from_json(const json& j, OnchainWithdrawal& withdrawal)
 {
-    withdrawal.amountRequested = ethsnarks::FieldT(j.at("amountRequested").get<std::string>().c_str());
+    withdrawal.amountRequested = parseFieldElement(j.at("amountRequested"));
     withdrawal.balanceUpdate = j.at("balanceUpdate").get<BalanceUpdate>();
     withdrawal.accountUpdate = j.at("accountUpdate").get<AccountUpdate>();
 }
@@ -413,24 +750,38 @@ public:
     std::vector<Loopring::OnchainWithdrawal> withdrawals;
 };
 
+template<typename Visitor>
+static void jsonFields(Visitor& v, OnchainWithdrawalBlock& block)
+{
+    v("exchangeID", block.exchangeID);
+
+    v("merkleRootBefore", block.merkleRootBefore);
+    v("merkleRootAfter", block.merkleRootAfter);
+
+    v("startHash", block.startHash);
+
+    v("startIndex", block.startIndex);
+    v("count", block.count);
+
+    v("withdrawals", block.withdrawals);
+}
+
 static void from_json(const json& j, OnchainWithdrawalBlock& block)
 {
     block.exchangeID = ethsnarks::FieldT(j["exchangeID"].get<unsigned int>());
 
-    block.merkleRootBefore = ethsnarks::FieldT(j["merkleRootBefore"].get<std::string>().c_str());
-    block.merkleRootAfter = ethsnarks::FieldT(j["merkleRootAfter"].get<std::string>().c_str());
+    block.merkleRootBefore = parseFieldElement(j["merkleRootBefore"]);
+    block.merkleRootAfter = parseFieldElement(j["merkleRootAfter"]);
 
-    block.startHash = ethsnarks::LimbT(j["startHash"].get<std::string>().c_str());
+    block.startHash = parseBigInt(j["startHash"]);
 
-    block.startIndex = ethsnarks::FieldT(j["startIndex"].get<std::string>().c_str());
-    block.count = ethsnarks::FieldT(j["count"].get<std::string>().c_str());
+    block.startIndex = parseFieldElement(j["startIndex"]);
+    block.count = parseFieldElement(j["count"]);
 
     // Read withdrawals
-    json jWithdrawals = j["withdrawals"];
-    for(unsigned int i = 0; i < jWithdrawals.size(); i++)
-    {
-        block.withdrawals.emplace_back(jWithdrawals[i].get<Loopring::OnchainWithdrawal>());
-    }
+    parallelFromJson(j["withdrawals"], block.withdrawals);
+
+    resolveProofs(block);
 }
 
 
@@ -447,10 +798,23 @@ public:
     BalanceUpdate balanceUpdateF_O;
 };
 
+template<typename Visitor>
+static void jsonFields(Visitor& v, OffchainWithdrawal& withdrawal)
+{
+    v("amountRequested", withdrawal.amountRequested);
+    v("fee", withdrawal.fee);
+    v("signature", withdrawal.signature);
+
+    v("balanceUpdateF_A", withdrawal.balanceUpdateF_A);
+    v("balanceUpdateW_A", withdrawal.balanceUpdateW_A);
+    v("accountUpdate_A", withdrawal.accountUpdate_A);
+    v("balanceUpdateF_O", withdrawal.balanceUpdateF_O);
+}
+
 static void from_json(const json& j, OffchainWithdrawal& withdrawal)
 {
-    withdrawal.amountRequested = ethsnarks::FieldT(j.at("amountRequested").get<std::string>().c_str());
-    withdrawal.fee = ethsnarks::FieldT(j["fee"].get<std::string>().c_str());
+    withdrawal.amountRequested = parseFieldElement(j.at("amountRequested"));
+    withdrawal.fee = parseFieldElement(j["fee"]);
     withdrawal.signature = j.at("signature").get<Signature>();
 
     withdrawal.balanceUpdateF_A = j.at("balanceUpdateF_A").get<BalanceUpdate>();
@@ -476,22 +840,34 @@ public:
     std::vector<Loopring::OffchainWithdrawal> withdrawals;
 };
 
+template<typename Visitor>
+static void jsonFields(Visitor& v, OffchainWithdrawalBlock& block)
+{
+    v("exchangeID", block.exchangeID);
+
+    v("merkleRootBefore", block.merkleRootBefore);
+    v("merkleRootAfter", block.merkleRootAfter);
+
+    v("operatorAccountID", block.operatorAccountID);
+    v("accountUpdate_O", block.accountUpdate_O);
+
+    v("withdrawals", block.withdrawals);
+}
+
 static void from_json(const json& j, OffchainWithdrawalBlock& block)
 {
     block.exchangeID = ethsnarks::FieldT(j["exchangeID"].get<unsigned int>());
 
-    block.merkleRootBefore = ethsnarks::FieldT(j["merkleRootBefore"].get<std::string>().c_str());
-    block.merkleRootAfter = ethsnarks::FieldT(j["merkleRootAfter"].get<std::string>().c_str());
+    block.merkleRootBefore = parseFieldElement(j["merkleRootBefore"]);
+    block.merkleRootAfter = parseFieldElement(j["merkleRootAfter"]);
 
     block.operatorAccountID = ethsnarks::FieldT(j.at("operatorAccountID"));
     block.accountUpdate_O = j.at("accountUpdate_O").get<AccountUpdate>();
 
     // Read withdrawals
-    json jWithdrawals = j["withdrawals"];
-    for(unsigned int i = 0; i < jWithdrawals.size(); i++)
-    {
-        block.withdrawals.emplace_back(jWithdrawals[i].get<Loopring::OffchainWithdrawal>());
-    }
+    parallelFromJson(j["withdrawals"], block.withdrawals);
+
+    resolveProofs(block);
 }
 
 /*
@@ -517,10 +893,30 @@ public:
     BalanceUpdate balanceUpdateF_O;	   // receive fee
 };
 
+template<typename Visitor>
+static void jsonFields(Visitor& v, InternalTransfer& interTrans)
+{
+    v("fee", interTrans.fee);
+    v("amountRequested", interTrans.amount);
+    v("type", interTrans.type);
+    v("signature", interTrans.signature);
+
+    v("numConditionalTransfersAfter", interTrans.numConditionalTransfersAfter);
+
+    v("balanceUpdateF_From", interTrans.balanceUpdateF_From);
+    v("balanceUpdateT_From", interTrans.balanceUpdateT_From);
+    v("accountUpdate_From", interTrans.accountUpdate_From);
+
+    v("balanceUpdateT_To", interTrans.balanceUpdateT_To);
+    v("accountUpdate_To", interTrans.accountUpdate_To);
+
+    v("balanceUpdateF_O", interTrans.balanceUpdateF_O);
+}
+
 static void from_json(const json& j, InternalTransfer& interTrans)
 {
-    interTrans.fee = ethsnarks::FieldT(j["fee"].get<std::string>().c_str());
-    interTrans.amount = ethsnarks::FieldT(j["amountRequested"].get<std::string>().c_str());
+    interTrans.fee = parseFieldElement(j["fee"]);
+    interTrans.amount = parseFieldElement(j["amountRequested"]);
     interTrans.type = ethsnarks::FieldT(j.at("type"));
     interTrans.signature = j.at("signature").get<Signature>();
 
@@ -550,22 +946,34 @@ public:
     std::vector<Loopring::InternalTransfer> transfers;
 };
 
+template<typename Visitor>
+static void jsonFields(Visitor& v, InternalTransferBlock& block)
+{
+    v("exchangeID", block.exchangeID);
+
+    v("merkleRootBefore", block.merkleRootBefore);
+    v("merkleRootAfter", block.merkleRootAfter);
+
+    v("operatorAccountID", block.operatorAccountID);
+    v("accountUpdate_O", block.accountUpdate_O);
+
+    v("transfers", block.transfers);
+}
+
 static void from_json(const json& j, InternalTransferBlock& block)
 {
     block.exchangeID = ethsnarks::FieldT(j["exchangeID"].get<unsigned int>());
 
-    block.merkleRootBefore = ethsnarks::FieldT(j["merkleRootBefore"].get<std::string>().c_str());
-    block.merkleRootAfter = ethsnarks::FieldT(j["merkleRootAfter"].get<std::string>().c_str());
+    block.merkleRootBefore = parseFieldElement(j["merkleRootBefore"]);
+    block.merkleRootAfter = parseFieldElement(j["merkleRootAfter"]);
 
     block.operatorAccountID = ethsnarks::FieldT(j.at("operatorAccountID"));
     block.accountUpdate_O = j.at("accountUpdate_O").get<AccountUpdate>();
 
     // Read internal transfers
-    json jTransfers = j["transfers"];
-    for(unsigned int i = 0; i < jTransfers.size(); i++)
-    {
-        block.transfers.emplace_back(jTransfers[i].get<Loopring::InternalTransfer>());
-    }
+    parallelFromJson(j["transfers"], block.transfers);
+
+    resolveProofs(block);
 }
 
 
@@ -0,0 +1,213 @@
+#ifndef _FIELDPARSER_H_
+#define _FIELDPARSER_H_
+
+#include "ethsnarks.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <string>
+#include <stdexcept>
+
+
+namespace Loopring
+{
+
+/**
+* Parses decimal and hexadecimal ("0x" prefixed) numbers directly into the limbs of
+* a bigint, without going through the generic string conversion of libff/GMP.
+*
+* Decimal strings are read in chunks of 19 digits (the most that fit in 64 bits), each
+* chunk is added with a single multiply-accumulate over the limbs. Within a chunk 8 digits
+* are converted at a time with a few 64-bit multiplications (SWAR). Field elements are
+* then converted to Montgomery form with a single Montgomery multiplication (by R^2).
+*/
+static_assert(sizeof(ethsnarks::LimbT().data[0]) == sizeof(uint64_t), "Expected 64-bit limbs");
+
+static const uint64_t POWERS_OF_TEN[20] = {
+    1ULL,
+    10ULL,
+    100ULL,
+    1000ULL,
+    10000ULL,
+    100000ULL,
+    1000000ULL,
+    10000000ULL,
+    100000000ULL,
+    1000000000ULL,
+    10000000000ULL,
+    100000000000ULL,
+    1000000000000ULL,
+    10000000000000ULL,
+    100000000000000ULL,
+    1000000000000000ULL,
+    10000000000000000ULL,
+    100000000000000000ULL,
+    1000000000000000000ULL,
+    10000000000000000000ULL
+};
+
+// value = value * factor + addend, returns false on overflow
+static bool mulAddLimbs(ethsnarks::LimbT& value, uint64_t factor, uint64_t addend)
+{
+    const unsigned int numLimbs = sizeof(value.data) / sizeof(value.data[0]);
+    unsigned __int128 carry = addend;
+    for (unsigned int i = 0; i < numLimbs; i++)
+    {
+        unsigned __int128 t = (unsigned __int128)(value.data[i]) * factor + carry;
+        value.data[i] = uint64_t(t);
+        carry = t >> 64;
+    }
+    return carry == 0;
+}
+
+// Converts 8 decimal digits, returns false if not all characters are digits
+static bool parseEightDigits(const char* str, uint64_t& value)
+{
+    uint64_t v;
+    memcpy(&v, str, sizeof(v));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    // Every byte needs to be in ['0', '9']
+    if ((((v & 0xF0F0F0F0F0F0F0F0ULL) | (((v + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) >> 4))) != 0x3333333333333333ULL)
+    {
+        return false;
+    }
+    // Combine pairs of digits, then pairs of pairs,... (the first character is the most significant digit)
+    v = ((v & 0x0F0F0F0F0F0F0F0FULL) * 2561) >> 8;
+    v = ((v & 0x00FF00FF00FF00FFULL) * 6553601) >> 16;
+    value = ((v & 0x0000FFFF0000FFFFULL) * 42949672960001ULL) >> 32;
+    return true;
+}
+
+static int hexDigit(char c)
+{
+    if (c >= '0' && c <= '9')
+    {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f')
+    {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F')
+    {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+// Returns false when the string isn't a number or doesn't fit in the bigint
+static bool parseBigInt(const char* str, ethsnarks::LimbT& value)
+{
+    for (auto& limb : value.data)
+    {
+        limb = 0;
+    }
+
+    if (str[0] == '0' && (str[1] == 'x' || str[1] == 'X'))
+    {
+        // Hexadecimal, 15 digits (60 bits) at a time
+        const char* p = str + 2;
+        if (*p == 0)
+        {
+            return false;
+        }
+        while (*p != 0)
+        {
+            uint64_t chunk = 0;
+            unsigned int numDigits = 0;
+            for (; *p != 0 && numDigits < 15; p++, numDigits++)
+            {
+                int digit = hexDigit(*p);
+                if (digit < 0)
+                {
+                    return false;
+                }
+                chunk = (chunk << 4) | uint64_t(digit);
+            }
+            if (!mulAddLimbs(value, uint64_t(1) << (4 * numDigits), chunk))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Decimal, 19 digits at a time
+    size_t length = strlen(str);
+    if (length == 0)
+    {
+        return false;
+    }
+    for (size_t i = 0; i < length;)
+    {
+        unsigned int numDigits = std::min<size_t>(length - i, 19);
+        uint64_t chunk = 0;
+        unsigned int j = 0;
+        for (; j + 8 <= numDigits; j += 8)
+        {
+            uint64_t digits;
+            if (!parseEightDigits(str + i + j, digits))
+            {
+                return false;
+            }
+            chunk = chunk * 100000000ULL + digits;
+        }
+        for (; j < numDigits; j++)
+        {
+            unsigned int digit = (unsigned int)(str[i + j] - '0');
+            if (digit > 9)
+            {
+                return false;
+            }
+            chunk = chunk * 10 + digit;
+        }
+        if (!mulAddLimbs(value, POWERS_OF_TEN[numDigits], chunk))
+        {
+            return false;
+        }
+        i += numDigits;
+    }
+    return true;
+}
+
+// Same result as FieldT(str) (values >= the field modulus are reduced)
+static bool parseFieldElement(const char* str, ethsnarks::FieldT& value)
+{
+    ethsnarks::LimbT bigint;
+    if (!parseBigInt(str, bigint))
+    {
+        return false;
+    }
+    value = ethsnarks::FieldT(bigint);
+    return true;
+}
+
+// JSON strings, throws like the json conversions do
+static ethsnarks::LimbT parseBigInt(const nlohmann::json& j)
+{
+    const std::string& str = j.get_ref<const std::string&>();
+    ethsnarks::LimbT value;
+    if (!parseBigInt(str.c_str(), value))
+    {
+        throw std::invalid_argument("Invalid number: " + str);
+    }
+    return value;
+}
+
+static ethsnarks::FieldT parseFieldElement(const nlohmann::json& j)
+{
+    const std::string& str = j.get_ref<const std::string&>();
+    ethsnarks::FieldT value;
+    if (!parseFieldElement(str.c_str(), value))
+    {
+        throw std::invalid_argument("Invalid field element: " + str);
+    }
+    return value;
+}
+
+}
+
+#endif
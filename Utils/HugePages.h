@@ -0,0 +1,132 @@
+#ifndef _HUGEPAGES_H_
+#define _HUGEPAGES_H_
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <cstdint>
+#include <sys/mman.h>
+
+
+namespace Loopring
+{
+
+/**
+* Backs large buffers (proving key queries, prover buffers) with transparent huge pages
+* to reduce TLB misses in the multiexp and the FFTs.
+*
+* The buffers are std::vectors owned by ethsnarks, so instead of a custom allocator the
+* memory of the vectors is advised with MADV_HUGEPAGE. This works as long as the kernel
+* has THP set to "always" or "madvise", otherwise the memory simply stays in normal pages.
+* Memory advised before it is first touched gets huge pages on the first page fault,
+* memory that was already touched is collapsed into huge pages by khugepaged later on.
+* When huge pages are disabled the memory is advised with MADV_NOHUGEPAGE instead, so
+* it also stays in normal pages when THP is set to "always".
+*/
+static const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+static bool& hugePagesEnabled()
+{
+    static bool enabled = true;
+    return enabled;
+}
+
+static void setHugePagesEnabled(bool enabled)
+{
+    hugePagesEnabled() = enabled;
+}
+
+// Returns the number of bytes advised (only whole huge pages inside the range are advised)
+static size_t adviseHugePages(const void* ptr, size_t size)
+{
+#if defined(MADV_HUGEPAGE) && defined(MADV_NOHUGEPAGE)
+    if (size < HUGE_PAGE_SIZE)
+    {
+        return 0;
+    }
+    uintptr_t begin = (reinterpret_cast<uintptr_t>(ptr) + HUGE_PAGE_SIZE - 1) & ~uintptr_t(HUGE_PAGE_SIZE - 1);
+    uintptr_t end = (reinterpret_cast<uintptr_t>(ptr) + size) & ~uintptr_t(HUGE_PAGE_SIZE - 1);
+    int advice = hugePagesEnabled() ? MADV_HUGEPAGE : MADV_NOHUGEPAGE;
+    if (end <= begin || madvise(reinterpret_cast<void*>(begin), end - begin, advice) != 0)
+    {
+        return 0;
+    }
+    return end - begin;
+#else
+    return 0;
+#endif
+}
+
+template<typename T>
+static size_t adviseHugePages(const std::vector<T>& values)
+{
+    return adviseHugePages(values.data(), values.capacity() * sizeof(T));
+}
+
+// Allocates the memory of an empty vector and advises it before it is touched
+template<typename T>
+static void reserveHugePages(std::vector<T>& values, size_t size)
+{
+    values.reserve(size);
+    adviseHugePages(values);
+}
+
+// THP mode of the kernel: "always", "madvise" or "never" (empty when not supported)
+static std::string getTransparentHugePagesMode()
+{
+    std::ifstream file("/sys/kernel/mm/transparent_hugepage/enabled");
+    std::string line;
+    std::getline(file, line);
+    size_t begin = line.find('[');
+    size_t end = line.find(']');
+    if (begin == std::string::npos || end == std::string::npos || end < begin)
+    {
+        return "";
+    }
+    return line.substr(begin + 1, end - begin - 1);
+}
+
+// Memory of the process backed by transparent huge pages (in bytes)
+static size_t getHugePageMemory()
+{
+    std::ifstream smaps("/proc/self/smaps_rollup");
+    if (!smaps.is_open())
+    {
+        smaps.open("/proc/self/smaps");
+    }
+    size_t total = 0;
+    std::string line;
+    while (std::getline(smaps, line))
+    {
+        if (line.compare(0, 14, "AnonHugePages:") == 0)
+        {
+            std::stringstream ss(line.substr(14));
+            size_t kb = 0;
+            ss >> kb;
+            total += kb * 1024;
+        }
+    }
+    return total;
+}
+
+// e.g. "on (THP: madvise, 1024MB backed by huge pages)"
+static std::string getHugePageStatus()
+{
+    std::string mode = getTransparentHugePagesMode();
+    std::stringstream ss;
+    ss << (hugePagesEnabled() ? "on" : "off")
+       << " (THP: " << (mode.length() != 0 ? mode : "not supported") << ", "
+       << getHugePageMemory() / (1024 * 1024) << "MB backed by huge pages)";
+    return ss.str();
+}
+
+static void printHugePageUsage()
+{
+    std::cout << "Huge pages: " << getHugePageStatus() << std::endl;
+}
+
+}
+
+#endif
@@ -0,0 +1,683 @@
+#ifndef _JOBQUEUE_H_
+#define _JOBQUEUE_H_
+
+#include "ethsnarks.hpp"
+#include "BlockFile.h"
+
+#include <map>
+#include <set>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <fstream>
+#include <cstdio>
+#include <limits>
+#include <algorithm>
+#include <ctime>
+#include <dirent.h>
+#include <sys/stat.h>
+
+using json = nlohmann::json;
+
+
+namespace Loopring
+{
+
+enum class JobState
+{
+    Queued = 0,
+    Witness,
+    Proving,
+    Done,
+    Failed
+};
+
+static std::string toString(JobState state)
+{
+    switch(state)
+    {
+        case JobState::Queued: return "queued";
+        case JobState::Witness: return "witness";
+        case JobState::Proving: return "proving";
+        case JobState::Done: return "done";
+        case JobState::Failed: return "failed";
+        default: return "unknown";
+    }
+}
+
+static JobState toJobState(const std::string& state)
+{
+    if (state == "witness") return JobState::Witness;
+    if (state == "proving") return JobState::Proving;
+    if (state == "done") return JobState::Done;
+    if (state == "failed") return JobState::Failed;
+    return JobState::Queued;
+}
+
+class Job
+{
+public:
+    uint64_t id = 0;
+    JobState state = JobState::Queued;
+
+    std::string blockFilename;
+    std::string proofFilename;
+    bool validate = false;
+
+    // Jobs with a deadline (unix time, 0 == none) are scheduled earliest deadline first,
+    // followed by the jobs without a deadline. Ties are broken by priority (highest first).
+    int priority = 0;
+    uint64_t deadline = 0;
+
+    // Name of the circuit the block is for (once known)
+    std::string circuit;
+
+    // Block sent in the request itself (not persisted), either parsed while it was received
+    // or as a json document
+    std::shared_ptr<const BlockFile> block;
+    std::shared_ptr<const json> input;
+    // Proof cache key of the block (once known)
+    std::string inputHash;
+    // Checkpoint of the generated witness (removed when the job is finished)
+    std::string checkpoint;
+
+    std::string proof;
+    std::string error;
+
+    uint64_t createdAt = 0;
+    uint64_t startedAt = 0;
+    uint64_t finishedAt = 0;
+
+    bool isFinished() const
+    {
+        return state == JobState::Done || state == JobState::Failed;
+    }
+
+    std::string getDescription() const
+    {
+        return (blockFilename.length() != 0) ? blockFilename : std::string("job ") + std::to_string(id);
+    }
+};
+
+static void to_json(json& j, const Job& job)
+{
+    j = json{
+        {"id", job.id},
+        {"state", toString(job.state)},
+        {"block_filename", job.blockFilename},
+        {"proof_filename", job.proofFilename},
+        {"validate", job.validate},
+        {"priority", job.priority},
+        {"deadline", job.deadline},
+        {"circuit", job.circuit},
+        {"input_hash", job.inputHash},
+        {"checkpoint", job.checkpoint},
+        {"error", job.error},
+        {"created_at", job.createdAt},
+        {"started_at", job.startedAt},
+        {"finished_at", job.finishedAt}
+    };
+    if (job.proof.length() > 0)
+    {
+        j["proof"] = json::parse(job.proof);
+    }
+}
+
+static void from_json(const json& j, Job& job)
+{
+    job.id = j.at("id").get<uint64_t>();
+    job.state = toJobState(j.at("state").get<std::string>());
+    job.blockFilename = j.at("block_filename").get<std::string>();
+    job.proofFilename = j.at("proof_filename").get<std::string>();
+    job.validate = j.at("validate").get<bool>();
+    job.priority = j.value("priority", 0);
+    job.deadline = j.value("deadline", uint64_t(0));
+    job.circuit = j.value("circuit", std::string());
+    job.inputHash = j.value("input_hash", std::string());
+    job.checkpoint = j.value("checkpoint", std::string());
+    job.error = j.at("error").get<std::string>();
+    job.createdAt = j.at("created_at").get<uint64_t>();
+    job.startedAt = j.at("started_at").get<uint64_t>();
+    job.finishedAt = j.at("finished_at").get<uint64_t>();
+    if (j.count("proof") > 0)
+    {
+        job.proof = j.at("proof").dump();
+    }
+}
+
+/**
+* Expected time a job will be finished, and if that is after its deadline.
+*/
+class JobEstimate
+{
+public:
+    uint64_t estimatedCompletion = 0;
+    bool atRisk = false;
+};
+
+/**
+* Bounded queue of prove jobs shared between the HTTP handlers and the prover threads.
+*
+* Jobs are dispatched earliest deadline first. The proving time of each circuit is
+* measured so jobs that are expected to miss their deadline can be reported.
+*
+* Every job is also written as a json record in the jobs directory (if one is set) so
+* that finished proofs can still be fetched after a restart, and jobs that were queued
+* or being proven when the process stopped are queued again.
+*/
+class JobQueue
+{
+public:
+    JobQueue(unsigned int _maxQueued, unsigned int _maxFinished, const std::string& _directory) :
+        maxQueued(_maxQueued),
+        maxFinished(_maxFinished),
+        directory(_directory),
+        nextID(1),
+        stopped(false)
+    {
+        load();
+    }
+
+    // Adds a new job to the queue. Returns 0 when the queue is full.
+    uint64_t push(const Job& job)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (queued.size() >= maxQueued)
+        {
+            return 0;
+        }
+        return insert(job);
+    }
+
+    // Adds a new job to the queue, waits while the queue is full.
+    // Returns 0 when the queue was stopped.
+    uint64_t pushWait(const Job& job)
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        cvNotFull.wait(lock, [this]{ return stopped || queued.size() < maxQueued; });
+        if (stopped)
+        {
+            return 0;
+        }
+        return insert(job);
+    }
+
+    // Adds a job that is already done (e.g. with a cached proof). Never rejected.
+    uint64_t add(const Job& _job, const std::string& proof)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        Job job = _job;
+        job.id = nextID++;
+        job.state = JobState::Done;
+        job.proof = proof;
+        job.block = nullptr;
+        job.input = nullptr;
+        job.createdAt = job.startedAt = job.finishedAt = timestamp();
+        jobs[job.id] = job;
+        store(job);
+        finished.push_back(job.id);
+        prune();
+        return job.id;
+    }
+
+    // Blocks until a job is available and marks it as being worked on.
+    // Returns false when the queue was stopped.
+    bool pop(Job& job)
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        cvQueued.wait(lock, [this]{ return stopped || !queued.empty(); });
+        if (stopped)
+        {
+            return false;
+        }
+        Job& next = jobs[queued.begin()->id];
+        queued.erase(queued.begin());
+        cvNotFull.notify_one();
+        next.state = JobState::Witness;
+        next.startedAt = timestamp();
+        store(next);
+        job = next;
+        return true;
+    }
+
+    void setState(uint64_t id, JobState state)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        auto it = jobs.find(id);
+        if (it != jobs.end())
+        {
+            it->second.state = state;
+            store(it->second);
+        }
+    }
+
+    void setCircuit(uint64_t id, const std::string& circuit)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        auto it = jobs.find(id);
+        if (it != jobs.end())
+        {
+            it->second.circuit = circuit;
+            store(it->second);
+        }
+    }
+
+    void setCheckpoint(uint64_t id, const std::string& checkpoint)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        auto it = jobs.find(id);
+        if (it != jobs.end())
+        {
+            it->second.checkpoint = checkpoint;
+            store(it->second);
+        }
+    }
+
+    // Updates the expected time needed to prove a block for the circuit
+    void recordDuration(const std::string& circuit, double seconds)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        auto it = durations.find(circuit);
+        durations[circuit] = (it == durations.end()) ? seconds : it->second * 0.7 + seconds * 0.3;
+    }
+
+    void finish(uint64_t id, const std::string& proof, const std::string& error)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        auto it = jobs.find(id);
+        if (it == jobs.end())
+        {
+            return;
+        }
+        Job& job = it->second;
+        job.state = (error.length() == 0) ? JobState::Done : JobState::Failed;
+        job.proof = proof;
+        job.error = error;
+        job.finishedAt = timestamp();
+        // The block is not needed anymore, only the result is kept
+        job.block = nullptr;
+        job.input = nullptr;
+        if (job.checkpoint.length() != 0)
+        {
+            std::remove(job.checkpoint.c_str());
+            job.checkpoint = "";
+        }
+        store(job);
+        finished.push_back(id);
+        prune();
+        cvFinished.notify_all();
+    }
+
+    bool get(uint64_t id, Job& job) const
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        auto it = jobs.find(id);
+        if (it == jobs.end())
+        {
+            return false;
+        }
+        job = it->second;
+        return true;
+    }
+
+    // Blocks until the job is finished. Returns false for unknown jobs.
+    bool wait(uint64_t id, Job& job)
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        if (jobs.find(id) == jobs.end())
+        {
+            return false;
+        }
+        // When stopped, the jobs already being worked on are still finished
+        cvFinished.wait(lock, [this, id]{
+            auto it = jobs.find(id);
+            return it == jobs.end() || it->second.isFinished() || (stopped && it->second.state == JobState::Queued);
+        });
+        auto it = jobs.find(id);
+        if (it == jobs.end())
+        {
+            return false;
+        }
+        job = it->second;
+        return job.isFinished();
+    }
+
+    std::vector<Job> getActive() const
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        std::vector<Job> active;
+        for (const auto& it : jobs)
+        {
+            if (it.second.state == JobState::Witness || it.second.state == JobState::Proving)
+            {
+                active.push_back(it.second);
+            }
+        }
+        return active;
+    }
+
+    size_t numQueued() const
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        return queued.size();
+    }
+
+    bool getEstimate(uint64_t id, JobEstimate& estimate) const
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        std::map<uint64_t, JobEstimate> estimates = getEstimates();
+        auto it = estimates.find(id);
+        if (it == estimates.end())
+        {
+            return false;
+        }
+        estimate = it->second;
+        return true;
+    }
+
+    std::vector<uint64_t> getJobsAtRisk() const
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        std::vector<uint64_t> atRisk;
+        for (const auto& it : getEstimates())
+        {
+            if (it.second.atRisk)
+            {
+                atRisk.push_back(it.first);
+            }
+        }
+        return atRisk;
+    }
+
+    void stop()
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        stopped = true;
+        cvQueued.notify_all();
+        cvNotFull.notify_all();
+        cvFinished.notify_all();
+    }
+
+private:
+
+    uint64_t insert(const Job& _job)
+    {
+        Job job = _job;
+        job.id = nextID++;
+        job.state = JobState::Queued;
+        job.createdAt = timestamp();
+        jobs[job.id] = job;
+        queued.insert(QueuedJob(job));
+        store(job);
+        cvQueued.notify_one();
+        return job.id;
+    }
+
+    // Sort key of a job in the queue
+    struct QueuedJob
+    {
+        uint64_t deadline;
+        int priority;
+        uint64_t id;
+
+        QueuedJob(const Job& job) :
+            deadline(job.deadline == 0 ? std::numeric_limits<uint64_t>::max() : job.deadline),
+            priority(job.priority),
+            id(job.id)
+        {
+
+        }
+
+        bool operator<(const QueuedJob& other) const
+        {
+            if (deadline != other.deadline) return deadline < other.deadline;
+            if (priority != other.priority) return priority > other.priority;
+            return id < other.id;
+        }
+    };
+
+    // Expected proving time of the job (in seconds)
+    double getDuration(const Job& job) const
+    {
+        auto it = durations.find(job.circuit);
+        if (it != durations.end())
+        {
+            return it->second;
+        }
+        // Unknown circuit, assume the slowest circuit measured
+        double duration = 0.0;
+        for (const auto& d : durations)
+        {
+            duration = std::max(duration, d.second);
+        }
+        return duration;
+    }
+
+    // Simulates the prover going through the active and queued jobs in order. Every job
+    // is only finished after the job before it (the measured duration also includes
+    // generating the witness, so the estimates are on the safe side).
+    std::map<uint64_t, JobEstimate> getEstimates() const
+    {
+        double current = double(timestamp());
+        // The time the prover is done with the jobs scheduled so far
+        double available = 0.0;
+        std::map<uint64_t, JobEstimate> estimates;
+        auto schedule = [&](const Job& job, double start) {
+            double completion = std::max(current, std::max(available, start) + getDuration(job));
+            available = completion;
+            JobEstimate& estimate = estimates[job.id];
+            estimate.estimatedCompletion = uint64_t(completion);
+            estimate.atRisk = (job.deadline != 0 && completion > double(job.deadline));
+        };
+        // The block being proven, then the block with its witness being generated
+        for (JobState state : {JobState::Proving, JobState::Witness})
+        {
+            for (const auto& it : jobs)
+            {
+                if (it.second.state == state)
+                {
+                    schedule(it.second, double(it.second.startedAt));
+                }
+            }
+        }
+        for (const QueuedJob& queuedJob : queued)
+        {
+            schedule(jobs.at(queuedJob.id), current);
+        }
+        return estimates;
+    }
+
+    static uint64_t timestamp()
+    {
+        return uint64_t(std::time(nullptr));
+    }
+
+    std::string getRecordFilename(uint64_t id) const
+    {
+        return directory + "/" + std::to_string(id) + ".json";
+    }
+
+    void store(const Job& job) const
+    {
+        if (directory.length() == 0)
+        {
+            return;
+        }
+        // Write to a temporary file first so a crash never leaves a partial record
+        std::string filename = getRecordFilename(job.id);
+        std::string tmpFilename = filename + ".tmp";
+        std::ofstream file(tmpFilename);
+        if (!file.is_open())
+        {
+            std::cerr << "Cannot write job record: " << tmpFilename << std::endl;
+            return;
+        }
+        file << json(job).dump();
+        file.close();
+        std::rename(tmpFilename.c_str(), filename.c_str());
+    }
+
+    void remove(uint64_t id) const
+    {
+        if (directory.length() != 0)
+        {
+            std::remove(getRecordFilename(id).c_str());
+        }
+    }
+
+    // Only keep the most recent finished jobs around
+    void prune()
+    {
+        while (finished.size() > maxFinished)
+        {
+            uint64_t id = finished.front();
+            finished.pop_front();
+            jobs.erase(id);
+            remove(id);
+        }
+    }
+
+    void load()
+    {
+        if (directory.length() == 0)
+        {
+            return;
+        }
+        mkdir(directory.c_str(), 0755);
+        DIR* dir = opendir(directory.c_str());
+        if (dir == nullptr)
+        {
+            std::cerr << "Cannot open jobs directory: " << directory << std::endl;
+            return;
+        }
+        while (struct dirent* entry = readdir(dir))
+        {
+            std::string name = entry->d_name;
+            if (name.length() <= 5 || name.compare(name.length() - 5, 5, ".json") != 0)
+            {
+                continue;
+            }
+            std::ifstream file(directory + "/" + name);
+            try
+            {
+                json record;
+                file >> record;
+                Job job = record.get<Job>();
+                jobs[job.id] = job;
+            }
+            catch (const std::exception& e)
+            {
+                std::cerr << "Ignoring invalid job record " << name << ": " << e.what() << std::endl;
+            }
+        }
+        closedir(dir);
+
+        // Jobs are stored in id order, so the original submission order is kept
+        for (auto& it : jobs)
+        {
+            Job& job = it.second;
+            nextID = std::max(nextID, job.id + 1);
+            // Blocks sent in the request can only be resumed from a witness checkpoint
+            if (!job.isFinished() && job.blockFilename.length() == 0 && job.checkpoint.length() == 0)
+            {
+                job.state = JobState::Failed;
+                job.error = "Block was sent in the request and was lost on restart!";
+                store(job);
+            }
+            if (job.isFinished())
+            {
+                finished.push_back(job.id);
+            }
+            else
+            {
+                job.state = JobState::Queued;
+                queued.insert(QueuedJob(job));
+            }
+        }
+        prune();
+        std::cout << "Loaded " << jobs.size() << " job records (" << queued.size() << " queued)" << std::endl;
+    }
+
+    const unsigned int maxQueued;
+    const unsigned int maxFinished;
+    const std::string directory;
+
+    uint64_t nextID;
+    bool stopped;
+    std::map<uint64_t, Job> jobs;
+    std::set<QueuedJob> queued;
+    std::map<std::string, double> durations;
+    std::deque<uint64_t> finished;
+
+    mutable std::mutex mtx;
+    std::condition_variable cvQueued;
+    std::condition_variable cvNotFull;
+    std::condition_variable cvFinished;
+};
+
+/**
+* Fixed capacity queue used to hand work from one pipeline stage to the next.
+*/
+template<typename T>
+class BoundedQueue
+{
+public:
+    BoundedQueue(unsigned int _capacity) :
+        capacity(_capacity),
+        closed(false)
+    {
+
+    }
+
+    // Blocks while the queue is full. Returns false when the queue was closed.
+    bool push(const T& item)
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        cvNotFull.wait(lock, [this]{ return closed || items.size() < capacity; });
+        if (closed)
+        {
+            return false;
+        }
+        items.push_back(item);
+        cvNotEmpty.notify_one();
+        return true;
+    }
+
+    // Blocks until an item is available. Returns false when the queue is closed and empty.
+    bool pop(T& item)
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        cvNotEmpty.wait(lock, [this]{ return closed || !items.empty(); });
+        if (items.empty())
+        {
+            return false;
+        }
+        item = items.front();
+        items.pop_front();
+        cvNotFull.notify_one();
+        return true;
+    }
+
+    // Items still in the queue can still be popped
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        closed = true;
+        cvNotEmpty.notify_all();
+        cvNotFull.notify_all();
+    }
+
+private:
+    const unsigned int capacity;
+    bool closed;
+    std::deque<T> items;
+
+    std::mutex mtx;
+    std::condition_variable cvNotEmpty;
+    std::condition_variable cvNotFull;
+};
+
+}
+
+#endif
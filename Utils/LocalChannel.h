@@ -0,0 +1,742 @@
+#ifndef _LOCALCHANNEL_H_
+#define _LOCALCHANNEL_H_
+
+#include "ethsnarks.hpp"
+#include "JobQueue.h"
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <algorithm>
+#include <deque>
+#include <condition_variable>
+#include <chrono>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+using json = nlohmann::json;
+
+
+namespace Loopring
+{
+
+/**
+* Binary submission channel for an operator running on the same host as the prover.
+*
+* The operator connects to a Unix domain socket. For every connection the prover creates
+* a shared memory segment holding two ring buffers, one for requests and one for responses,
+* and sends its name over the socket. Records are written directly in the rings; the socket
+* is only used to send a single byte "doorbell" after a ring was written to or read from.
+*
+* Requests carry a block encoded in CBOR (or MessagePack), responses carry the proof (CBOR)
+* or an error message. A writer waits when the ring is full, so a client submitting blocks
+* faster than they can be queued is slowed down.
+*/
+
+enum class RecordType : uint32_t
+{
+    Prove = 1,
+    Proof,
+    Error
+};
+
+// Request flags
+static const uint32_t RECORD_FLAG_VALIDATE = 1;
+static const uint32_t RECORD_FLAG_MSGPACK = 2;
+
+struct RecordHeader
+{
+    // Chosen by the client, responses have the id of their request
+    uint64_t id;
+    uint32_t type;
+    uint32_t flags;
+    uint64_t length;
+};
+
+// Start of a ring in the shared memory segment. head and tail only ever increase.
+struct RingHeader
+{
+    std::atomic<uint64_t> head;
+    std::atomic<uint64_t> tail;
+    uint64_t capacity;
+    uint8_t padding[40];
+};
+
+/**
+* Single producer, single consumer ring of records in shared memory.
+*
+* The other side of the ring can write anything in the shared memory, so the capacity is
+* kept outside of it and the head, tail and record lengths are checked before they are used.
+* A ring in an invalid state is marked as corrupted and is not used anymore.
+*/
+class ShmRing
+{
+public:
+    ShmRing() :
+        header(nullptr),
+        data(nullptr),
+        capacity(0),
+        corrupted(false)
+    {
+
+    }
+
+    ShmRing(RingHeader* _header, uint8_t* _data, uint64_t _capacity) :
+        header(_header),
+        data(_data),
+        capacity(_capacity),
+        corrupted(false)
+    {
+
+    }
+
+    uint64_t getCapacity() const
+    {
+        return capacity;
+    }
+
+    bool isCorrupted() const
+    {
+        return corrupted;
+    }
+
+    // Returns false when there is not enough space for the record at the moment (or the ring is corrupted)
+    bool write(const RecordHeader& record, const uint8_t* payload)
+    {
+        uint64_t tail = header->tail.load(std::memory_order_relaxed);
+        uint64_t head = header->head.load(std::memory_order_acquire);
+        if (corrupted || tail - head > capacity)
+        {
+            corrupted = true;
+            return false;
+        }
+        if (capacity - (tail - head) < sizeof(RecordHeader) + record.length)
+        {
+            return false;
+        }
+        copyIn(tail, reinterpret_cast<const uint8_t*>(&record), sizeof(RecordHeader));
+        copyIn(tail + sizeof(RecordHeader), payload, record.length);
+        header->tail.store(tail + sizeof(RecordHeader) + record.length, std::memory_order_release);
+        return true;
+    }
+
+    // Returns false when the ring is empty (or corrupted)
+    bool read(RecordHeader& record, std::vector<uint8_t>& payload)
+    {
+        uint64_t head = header->head.load(std::memory_order_relaxed);
+        uint64_t tail = header->tail.load(std::memory_order_acquire);
+        if (corrupted || tail == head)
+        {
+            return false;
+        }
+        uint64_t used = tail - head;
+        if (used > capacity || used < sizeof(RecordHeader))
+        {
+            corrupted = true;
+            return false;
+        }
+        copyOut(head, reinterpret_cast<uint8_t*>(&record), sizeof(RecordHeader));
+        if (record.length > used - sizeof(RecordHeader))
+        {
+            corrupted = true;
+            return false;
+        }
+        payload.resize(record.length);
+        copyOut(head + sizeof(RecordHeader), payload.data(), record.length);
+        header->head.store(head + sizeof(RecordHeader) + record.length, std::memory_order_release);
+        return true;
+    }
+
+private:
+
+    void copyIn(uint64_t offset, const uint8_t* src, uint64_t length)
+    {
+        uint64_t pos = offset % capacity;
+        uint64_t first = std::min(length, capacity - pos);
+        memcpy(data + pos, src, first);
+        memcpy(data, src + first, length - first);
+    }
+
+    void copyOut(uint64_t offset, uint8_t* dst, uint64_t length) const
+    {
+        uint64_t pos = offset % capacity;
+        uint64_t first = std::min(length, capacity - pos);
+        memcpy(dst, data + pos, first);
+        memcpy(dst + first, data, length - first);
+    }
+
+    RingHeader* header;
+    uint8_t* data;
+    uint64_t capacity;
+    bool corrupted;
+};
+
+/**
+* The shared memory segment of a connection: request ring followed by the response ring.
+*/
+class ShmSegment
+{
+public:
+    ShmSegment() :
+        memory(nullptr),
+        size(0)
+    {
+
+    }
+
+    ~ShmSegment()
+    {
+        if (memory != nullptr)
+        {
+            munmap(memory, size);
+        }
+    }
+
+    static size_t getSize(uint64_t ringCapacity)
+    {
+        return 2 * sizeof(RingHeader) + 2 * ringCapacity;
+    }
+
+    bool create(const std::string& name, uint64_t ringCapacity)
+    {
+        int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+        if (fd < 0)
+        {
+            std::cerr << "Cannot create shared memory: " << name << std::endl;
+            return false;
+        }
+        bool ok = (ftruncate(fd, getSize(ringCapacity)) == 0) && map(fd, getSize(ringCapacity));
+        close(fd);
+        if (!ok)
+        {
+            shm_unlink(name.c_str());
+            return false;
+        }
+        RingHeader* headers = reinterpret_cast<RingHeader*>(memory);
+        for (unsigned int i = 0; i < 2; i++)
+        {
+            headers[i].head = 0;
+            headers[i].tail = 0;
+            headers[i].capacity = ringCapacity;
+        }
+        initRings(ringCapacity);
+        return true;
+    }
+
+    bool open(const std::string& name)
+    {
+        int fd = shm_open(name.c_str(), O_RDWR, 0600);
+        if (fd < 0)
+        {
+            std::cerr << "Cannot open shared memory: " << name << std::endl;
+            return false;
+        }
+        struct stat st;
+        bool ok = (fstat(fd, &st) == 0) && size_t(st.st_size) >= 2 * sizeof(RingHeader) && map(fd, size_t(st.st_size));
+        close(fd);
+        if (!ok)
+        {
+            return false;
+        }
+        uint64_t ringCapacity = reinterpret_cast<RingHeader*>(memory)->capacity;
+        if (ringCapacity == 0 || ringCapacity > (size - 2 * sizeof(RingHeader)) / 2)
+        {
+            std::cerr << "Invalid shared memory: " << name << std::endl;
+            return false;
+        }
+        initRings(ringCapacity);
+        return true;
+    }
+
+    ShmRing requests;
+    ShmRing responses;
+
+private:
+
+    bool map(int fd, size_t _size)
+    {
+        void* ptr = mmap(nullptr, _size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (ptr == MAP_FAILED)
+        {
+            return false;
+        }
+        memory = static_cast<uint8_t*>(ptr);
+        size = _size;
+        return true;
+    }
+
+    void initRings(uint64_t ringCapacity)
+    {
+        RingHeader* headers = reinterpret_cast<RingHeader*>(memory);
+        uint8_t* data = memory + 2 * sizeof(RingHeader);
+        requests = ShmRing(&headers[0], data, ringCapacity);
+        responses = ShmRing(&headers[1], data + ringCapacity, ringCapacity);
+    }
+
+    uint8_t* memory;
+    size_t size;
+};
+
+static bool sendDoorbell(int fd)
+{
+    char doorbell = 1;
+    return send(fd, &doorbell, 1, MSG_NOSIGNAL) == 1;
+}
+
+static bool decodeBlock(const std::vector<uint8_t>& payload, uint32_t flags, json& block, std::string& error)
+{
+    try
+    {
+        block = (flags & RECORD_FLAG_MSGPACK) ? json::from_msgpack(payload) : json::from_cbor(payload);
+        return true;
+    }
+    catch (const std::exception& e)
+    {
+        error = std::string("Failed to decode block: ") + e.what();
+        return false;
+    }
+}
+
+class LocalRequest
+{
+public:
+    uint64_t id = 0;
+    bool validate = false;
+    std::shared_ptr<const json> block;
+};
+
+/**
+* Accepts operator connections on a Unix domain socket.
+*/
+class LocalServer
+{
+public:
+    // Queues the block and returns its job id (0 on failure). May block while the prover is busy.
+    typedef std::function<uint64_t(const LocalRequest& request, std::string& error)> SubmitFunc;
+    // Waits for the job to be done. Returns false when it failed.
+    typedef std::function<bool(uint64_t jobID, std::string& proof, std::string& error)> WaitFunc;
+
+    LocalServer(const std::string& _path, uint64_t _ringCapacity, SubmitFunc _submit, WaitFunc _wait) :
+        path(_path),
+        ringCapacity(_ringCapacity),
+        submit(_submit),
+        wait(_wait),
+        listenFd(-1),
+        stopped(false),
+        numConnections(0)
+    {
+
+    }
+
+    ~LocalServer()
+    {
+        stop();
+    }
+
+    bool start()
+    {
+        reaperThread = std::thread([this]() { reapConnections(); });
+        listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (listenFd < 0 || path.length() >= sizeof(addr.sun_path))
+        {
+            std::cerr << "Cannot create socket: " << path << std::endl;
+            stopReaper();
+            return false;
+        }
+        strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+        unlink(path.c_str());
+        if (bind(listenFd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(listenFd, 16) != 0)
+        {
+            std::cerr << "Cannot listen on socket: " << path << std::endl;
+            close(listenFd);
+            listenFd = -1;
+            stopReaper();
+            return false;
+        }
+        acceptThread = std::thread([this]() { acceptConnections(); });
+        std::cout << "Accepting blocks on socket " << path << std::endl;
+        return true;
+    }
+
+    // Stops accepting blocks, jobs already submitted are still answered
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            if (stopped || listenFd < 0)
+            {
+                stopped = true;
+                return;
+            }
+            stopped = true;
+            shutdown(listenFd, SHUT_RDWR);
+            for (auto& connection : connections)
+            {
+                shutdown(connection->fd, SHUT_RD);
+            }
+        }
+        acceptThread.join();
+        // All readers see the end of their connection, the reaper is done once they are all removed
+        stopReaper();
+        close(listenFd);
+        unlink(path.c_str());
+    }
+
+    size_t getNumConnections() const
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        return connections.size();
+    }
+
+private:
+
+    struct Connection
+    {
+        int fd = -1;
+        std::string shmName;
+        ShmSegment segment;
+        // Jobs submitted on this connection, in order: (request id, job id)
+        BoundedQueue<std::pair<uint64_t, uint64_t>> pending;
+        std::thread reader;
+        std::thread writer;
+
+        std::atomic<bool> closed;
+        std::mutex mtx;
+        std::condition_variable doorbell;
+
+        Connection() : pending(1024), closed(false) {}
+    };
+
+    void acceptConnections()
+    {
+        while (true)
+        {
+            int fd = accept(listenFd, nullptr, nullptr);
+            std::lock_guard<std::mutex> lock(mtx);
+            if (stopped)
+            {
+                if (fd >= 0)
+                {
+                    close(fd);
+                }
+                return;
+            }
+            if (fd < 0)
+            {
+                continue;
+            }
+            std::unique_ptr<Connection> connection(new Connection());
+            connection->fd = fd;
+            connection->shmName = "/loopring_prover_" + std::to_string(getpid()) + "_" + std::to_string(++numConnections);
+            uint32_t nameLength = connection->shmName.length();
+            if (!connection->segment.create(connection->shmName, ringCapacity) ||
+                send(fd, &nameLength, sizeof(nameLength), MSG_NOSIGNAL) != sizeof(nameLength) ||
+                send(fd, connection->shmName.data(), nameLength, MSG_NOSIGNAL) != ssize_t(nameLength))
+            {
+                shm_unlink(connection->shmName.c_str());
+                close(fd);
+                continue;
+            }
+            Connection* c = connection.get();
+            c->reader = std::thread([this, c]() { readRequests(*c); });
+            c->writer = std::thread([this, c]() { writeResponses(*c); });
+            connections.push_back(std::move(connection));
+        }
+    }
+
+    // Removes the connections closed by their reader once the jobs submitted on them are done
+    void reapConnections()
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        while (true)
+        {
+            reapCV.wait(lock, [this]{ return !closedConnections.empty() || (stopped && connections.empty()); });
+            if (closedConnections.empty())
+            {
+                return;
+            }
+            Connection* connection = closedConnections.front();
+            closedConnections.pop_front();
+            lock.unlock();
+            connection->reader.join();
+            connection->writer.join();
+            close(connection->fd);
+            shm_unlink(connection->shmName.c_str());
+            lock.lock();
+            // Also unmaps the shared memory
+            connections.erase(std::remove_if(connections.begin(), connections.end(),
+                [connection](const std::unique_ptr<Connection>& c) { return c.get() == connection; }), connections.end());
+        }
+    }
+
+    void stopReaper()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            stopped = true;
+            reapCV.notify_all();
+        }
+        if (reaperThread.joinable())
+        {
+            reaperThread.join();
+        }
+    }
+
+    // Reads requests every time the client rings the doorbell
+    void readRequests(Connection& connection)
+    {
+        char buffer[64];
+        RecordHeader record;
+        std::vector<uint8_t> payload;
+        bool unlinked = false;
+        while (recv(connection.fd, buffer, sizeof(buffer), 0) > 0)
+        {
+            // The client has the shared memory mapped once it rings the doorbell,
+            // so the segment is removed as soon as both sides unmap it.
+            if (!unlinked)
+            {
+                shm_unlink(connection.shmName.c_str());
+                unlinked = true;
+            }
+            connection.doorbell.notify_all();
+            while (connection.segment.requests.read(record, payload))
+            {
+                // Let the client know there is space again
+                sendDoorbell(connection.fd);
+
+                LocalRequest request;
+                request.id = record.id;
+                request.validate = (record.flags & RECORD_FLAG_VALIDATE) != 0;
+                json block;
+                std::string error;
+                uint64_t jobID = 0;
+                if (record.type != uint32_t(RecordType::Prove))
+                {
+                    error = "Unknown request type!";
+                }
+                else if (decodeBlock(payload, record.flags, block, error))
+                {
+                    payload = std::vector<uint8_t>();
+                    request.block = std::make_shared<const json>(std::move(block));
+                    jobID = submit(request, error);
+                }
+                if (jobID == 0)
+                {
+                    writeResponse(connection, record.id, RecordType::Error, std::vector<uint8_t>(error.begin(), error.end()));
+                    continue;
+                }
+                connection.pending.push(std::make_pair(record.id, jobID));
+            }
+            if (connection.segment.requests.isCorrupted())
+            {
+                std::cerr << "Closing local connection " << connection.shmName << ": invalid request ring" << std::endl;
+                shutdown(connection.fd, SHUT_RDWR);
+                break;
+            }
+        }
+        connection.closed = true;
+        connection.pending.close();
+        connection.doorbell.notify_all();
+
+        std::lock_guard<std::mutex> lock(mtx);
+        closedConnections.push_back(&connection);
+        reapCV.notify_all();
+    }
+
+    // Sends back the results of the queued jobs in the order they were submitted
+    // (requests that could not be queued are answered immediately)
+    void writeResponses(Connection& connection)
+    {
+        std::pair<uint64_t, uint64_t> job;
+        while (connection.pending.pop(job))
+        {
+            std::string proof;
+            std::string error;
+            if (wait(job.second, proof, error))
+            {
+                writeResponse(connection, job.first, RecordType::Proof, json::to_cbor(json::parse(proof)));
+            }
+            else
+            {
+                writeResponse(connection, job.first, RecordType::Error, std::vector<uint8_t>(error.begin(), error.end()));
+            }
+        }
+    }
+
+    void writeResponse(Connection& connection, uint64_t id, RecordType type, const std::vector<uint8_t>& payload)
+    {
+        RecordHeader record = {id, uint32_t(type), 0, payload.size()};
+        std::unique_lock<std::mutex> lock(connection.mtx);
+        // Wait for the client to make space (it rings the doorbell after reading responses)
+        while (!connection.segment.responses.write(record, payload.data()))
+        {
+            if (connection.closed || connection.segment.responses.isCorrupted() ||
+                sizeof(RecordHeader) + payload.size() > connection.segment.responses.getCapacity())
+            {
+                return;
+            }
+            connection.doorbell.wait_for(lock, std::chrono::milliseconds(100));
+        }
+        sendDoorbell(connection.fd);
+    }
+
+    const std::string path;
+    const uint64_t ringCapacity;
+    SubmitFunc submit;
+    WaitFunc wait;
+
+    int listenFd;
+    bool stopped;
+    unsigned int numConnections;
+    std::thread acceptThread;
+    std::thread reaperThread;
+    std::vector<std::unique_ptr<Connection>> connections;
+    std::deque<Connection*> closedConnections;
+    mutable std::mutex mtx;
+    std::condition_variable reapCV;
+};
+
+/**
+* Operator side of the channel. Blocks can be sent from one thread while the
+* responses are received in another thread.
+*/
+class LocalClient
+{
+public:
+    LocalClient() :
+        fd(-1)
+    {
+
+    }
+
+    ~LocalClient()
+    {
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+    }
+
+    bool connect(const std::string& path)
+    {
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+        if (fd < 0 || ::connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0)
+        {
+            std::cerr << "Cannot connect to socket: " << path << std::endl;
+            return false;
+        }
+        uint32_t nameLength = 0;
+        if (!receiveAll(&nameLength, sizeof(nameLength)))
+        {
+            return false;
+        }
+        std::string name(nameLength, '\0');
+        if (!receiveAll(&name[0], nameLength))
+        {
+            return false;
+        }
+        return segment.open(name);
+    }
+
+    // Submits a block. Blocks while the request ring is full.
+    bool send(uint64_t id, const json& block, bool validate)
+    {
+        std::vector<uint8_t> payload = json::to_cbor(block);
+        RecordHeader record = {id, uint32_t(RecordType::Prove), validate ? RECORD_FLAG_VALIDATE : 0, payload.size()};
+        if (sizeof(RecordHeader) + payload.size() > segment.requests.getCapacity())
+        {
+            std::cerr << "Block does not fit in the request ring!" << std::endl;
+            return false;
+        }
+        while (!segment.requests.write(record, payload.data()))
+        {
+            if (!waitDoorbell())
+            {
+                return false;
+            }
+        }
+        return sendDoorbell(fd);
+    }
+
+    // Waits for the next response. 'error' is set when the block could not be proven.
+    bool receive(uint64_t& id, json& proof, std::string& error)
+    {
+        RecordHeader record;
+        std::vector<uint8_t> payload;
+        while (!segment.responses.read(record, payload))
+        {
+            if (!waitDoorbell())
+            {
+                return false;
+            }
+        }
+        // Let the server know there is space again
+        sendDoorbell(fd);
+        id = record.id;
+        if (record.type == uint32_t(RecordType::Proof))
+        {
+            proof = json::from_cbor(payload);
+            error = "";
+        }
+        else
+        {
+            error = std::string(payload.begin(), payload.end());
+        }
+        return true;
+    }
+
+private:
+
+    // Returns false when the connection was closed. The doorbell may be answered by
+    // another thread, so the rings are checked again after a short time regardless.
+    bool waitDoorbell()
+    {
+        struct pollfd pfd = {fd, POLLIN, 0};
+        if (poll(&pfd, 1, 10) <= 0)
+        {
+            return true;
+        }
+        char buffer[64];
+        ssize_t n = recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+        return n > 0 || (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK));
+    }
+
+    bool receiveAll(void* data, size_t length)
+    {
+        size_t received = 0;
+        while (received < length)
+        {
+            ssize_t n = recv(fd, static_cast<char*>(data) + received, length - received, 0);
+            if (n <= 0)
+            {
+                return false;
+            }
+            received += n;
+        }
+        return true;
+    }
+
+    int fd;
+    ShmSegment segment;
+};
+
+}
+
+#endif
@@ -0,0 +1,84 @@
+#ifndef _MAPPEDFILE_H_
+#define _MAPPEDFILE_H_
+
+#include <string>
+#include <iostream>
+#include <algorithm>
+#include <cstdint>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+namespace Loopring
+{
+
+/**
+* Read-only mapping of a whole file.
+*/
+class MappedFile
+{
+public:
+    MappedFile() :
+        data(nullptr),
+        size(0)
+    {
+
+    }
+
+    ~MappedFile()
+    {
+        if (data != nullptr)
+        {
+            munmap(const_cast<uint8_t*>(data), size);
+        }
+    }
+
+    // 'populate' reads the whole file in memory up front, otherwise pages are read when they are accessed
+    bool open(const std::string& filename, bool populate = true)
+    {
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            std::cerr << "Cannot open file: " << filename << std::endl;
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0)
+        {
+            close(fd);
+            return false;
+        }
+        void* ptr = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE | (populate ? MAP_POPULATE : 0), fd, 0);
+        close(fd);
+        if (ptr == MAP_FAILED)
+        {
+            std::cerr << "Cannot map file: " << filename << std::endl;
+            return false;
+        }
+        data = static_cast<const uint8_t*>(ptr);
+        size = size_t(st.st_size);
+        madvise(ptr, size, MADV_SEQUENTIAL);
+        return true;
+    }
+
+    // Drops the pages of [begin, end) that are no longer needed from memory
+    void release(size_t begin, size_t end) const
+    {
+        size_t pageSize = size_t(sysconf(_SC_PAGESIZE));
+        begin = (begin + pageSize - 1) / pageSize * pageSize;
+        end = std::min(end, size) / pageSize * pageSize;
+        if (begin < end)
+        {
+            madvise(const_cast<uint8_t*>(data) + begin, end - begin, MADV_DONTNEED);
+        }
+    }
+
+    const uint8_t* data;
+    size_t size;
+};
+
+}
+
+#endif
@@ -0,0 +1,214 @@
+#ifndef _METRICS_H_
+#define _METRICS_H_
+
+#include <map>
+#include <mutex>
+#include <vector>
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <limits>
+
+
+namespace Loopring
+{
+
+typedef std::vector<std::pair<std::string, std::string>> MetricLabels;
+
+enum class MetricType
+{
+    Counter = 0,
+    Gauge,
+    Histogram
+};
+
+/**
+* Counters, gauges and histograms exported in the Prometheus text format.
+*/
+class Metrics
+{
+public:
+
+    static Metrics& getInstance()
+    {
+        static Metrics instance;
+        return instance;
+    }
+
+    void describe(const std::string& name, MetricType type, const std::string& help,
+                  const std::vector<double>& buckets = std::vector<double>())
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        Family& family = families[name];
+        family.type = type;
+        family.help = help;
+        family.buckets = buckets;
+    }
+
+    void increment(const std::string& name, const MetricLabels& labels = MetricLabels(), double value = 1.0)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        getSeries(name, labels).value += value;
+    }
+
+    void set(const std::string& name, const MetricLabels& labels, double value)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        getSeries(name, labels).value = value;
+    }
+
+    void observe(const std::string& name, const MetricLabels& labels, double value)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        Family& family = families[name];
+        Series& series = getSeries(name, labels);
+        series.bucketCounts.resize(family.buckets.size(), 0);
+        for (unsigned int i = 0; i < family.buckets.size(); i++)
+        {
+            if (value <= family.buckets[i])
+            {
+                series.bucketCounts[i]++;
+            }
+        }
+        series.value += value;
+        series.count++;
+    }
+
+    // Sum of the values observed in all series of a metric, per value of 'label'
+    std::map<std::string, double> getSums(const std::string& name, const std::string& label) const
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        std::map<std::string, double> sums;
+        auto family = families.find(name);
+        if (family == families.end())
+        {
+            return sums;
+        }
+        std::string prefix = label + "=\"";
+        for (const auto& series : family->second.series)
+        {
+            const std::string& labels = series.first;
+            size_t pos = labels.find(prefix);
+            while (pos != std::string::npos && pos != 0 && labels[pos - 1] != ',')
+            {
+                pos = labels.find(prefix, pos + 1);
+            }
+            if (pos == std::string::npos)
+            {
+                continue;
+            }
+            size_t begin = pos + prefix.length();
+            std::string value = labels.substr(begin, labels.find('"', begin) - begin);
+            sums[value] += series.second.value;
+        }
+        return sums;
+    }
+
+    std::string render() const
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        std::stringstream ss;
+        ss.precision(std::numeric_limits<double>::digits10);
+        for (const auto& it : families)
+        {
+            const std::string& name = it.first;
+            const Family& family = it.second;
+            ss << "# HELP " << name << " " << family.help << "\n";
+            ss << "# TYPE " << name << " " << toString(family.type) << "\n";
+            for (const auto& series : family.series)
+            {
+                if (family.type != MetricType::Histogram)
+                {
+                    ss << name << formatLabels(series.first, "") << " " << series.second.value << "\n";
+                    continue;
+                }
+                for (unsigned int i = 0; i < family.buckets.size(); i++)
+                {
+                    uint64_t count = (i < series.second.bucketCounts.size()) ? series.second.bucketCounts[i] : 0;
+                    std::stringstream le;
+                    le << "le=\"" << family.buckets[i] << "\"";
+                    ss << name << "_bucket" << formatLabels(series.first, le.str()) << " " << count << "\n";
+                }
+                ss << name << "_bucket" << formatLabels(series.first, "le=\"+Inf\"") << " " << series.second.count << "\n";
+                ss << name << "_sum" << formatLabels(series.first, "") << " " << series.second.value << "\n";
+                ss << name << "_count" << formatLabels(series.first, "") << " " << series.second.count << "\n";
+            }
+        }
+        return ss.str();
+    }
+
+private:
+
+    struct Series
+    {
+        double value = 0.0;
+        uint64_t count = 0;
+        std::vector<uint64_t> bucketCounts;
+    };
+
+    struct Family
+    {
+        MetricType type = MetricType::Gauge;
+        std::string help;
+        std::vector<double> buckets;
+        // Indexed by the formatted labels
+        std::map<std::string, Series> series;
+    };
+
+    Metrics() {}
+
+    static const char* toString(MetricType type)
+    {
+        switch(type)
+        {
+            case MetricType::Counter: return "counter";
+            case MetricType::Histogram: return "histogram";
+            default: return "gauge";
+        }
+    }
+
+    static std::string formatLabels(const std::string& labels, const std::string& extra)
+    {
+        std::string all = labels;
+        if (extra.length() > 0)
+        {
+            all += (all.length() > 0 ? "," : "") + extra;
+        }
+        return (all.length() > 0) ? "{" + all + "}" : "";
+    }
+
+    Series& getSeries(const std::string& name, const MetricLabels& labels)
+    {
+        std::string key;
+        for (const auto& label : labels)
+        {
+            key += (key.length() > 0 ? "," : "") + label.first + "=\"" + label.second + "\"";
+        }
+        return families[name].series[key];
+    }
+
+    std::map<std::string, Family> families;
+    mutable std::mutex mtx;
+};
+
+// Returns a value in kB from /proc/self/status (e.g. VmRSS or VmHWM)
+static size_t getProcessStatus(const std::string& field)
+{
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line))
+    {
+        if (line.compare(0, field.length() + 1, field + ":") == 0)
+        {
+            std::stringstream ss(line.substr(field.length() + 1));
+            size_t value = 0;
+            ss >> value;
+            return value;
+        }
+    }
+    return 0;
+}
+
+}
+
+#endif
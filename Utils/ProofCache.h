@@ -0,0 +1,183 @@
+#ifndef _PROOFCACHE_H_
+#define _PROOFCACHE_H_
+
+#include "ethsnarks.hpp"
+#include "Hash.h"
+
+#include <map>
+#include <mutex>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <dirent.h>
+#include <utime.h>
+#include <sys/stat.h>
+
+using json = nlohmann::json;
+
+
+namespace Loopring
+{
+
+/**
+* On-disk cache of generated proofs, addressed by the hash of the block and the proving key.
+*
+* A block that was already proven (e.g. resubmitted after a restart or a retry) gets its
+* proof back without being proven again. The least recently used proofs are removed when
+* there are more than maxEntries proofs. The last use of a proof is kept as the modification
+* time of its file so the order survives a restart.
+*/
+class ProofCache
+{
+public:
+    ProofCache(const std::string& _directory, unsigned int _maxEntries) :
+        directory(_directory),
+        maxEntries(_maxEntries),
+        useCounter(0)
+    {
+        load();
+    }
+
+    bool isEnabled() const
+    {
+        return directory.length() != 0 && maxEntries != 0;
+    }
+
+    // 'blockHash' is the hash of the canonical form of the block (see hashBlock in BlockIO.h), 'provingKeyID' identifies the key the proof is generated with.
+    // Proofs of blocks that were validated before they were proven are stored under a different key,
+    // so a request to validate a block never gets back the proof of a block that was not validated.
+    static std::string getKey(const std::string& blockHash, const std::string& provingKeyID, bool validated)
+    {
+        Sha256 hasher;
+        hasher.update(provingKeyID);
+        hasher.update("\n");
+        hasher.update(blockHash);
+        hasher.update(validated ? "\nvalidated" : "\n");
+        return hasher.finalize();
+    }
+
+    bool get(const std::string& key, std::string& proof)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        auto it = entries.find(key);
+        if (it == entries.end())
+        {
+            return false;
+        }
+        std::ifstream file(getFilename(key));
+        if (!file.is_open())
+        {
+            entries.erase(it);
+            return false;
+        }
+        std::stringstream ss;
+        ss << file.rdbuf();
+        proof = ss.str();
+        it->second = ++useCounter;
+        utime(getFilename(key).c_str(), nullptr);
+        return proof.length() != 0;
+    }
+
+    void put(const std::string& key, const std::string& proof)
+    {
+        if (!isEnabled())
+        {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mtx);
+        // Write to a temporary file first so a crash never leaves a partial proof
+        std::string filename = getFilename(key);
+        std::string tmpFilename = filename + ".tmp";
+        std::ofstream file(tmpFilename);
+        if (!file.is_open())
+        {
+            std::cerr << "Cannot write cached proof: " << tmpFilename << std::endl;
+            return;
+        }
+        file << proof;
+        file.close();
+        std::rename(tmpFilename.c_str(), filename.c_str());
+        entries[key] = ++useCounter;
+        evict();
+    }
+
+    size_t size() const
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        return entries.size();
+    }
+
+private:
+
+    std::string getFilename(const std::string& key) const
+    {
+        return directory + "/" + key + ".json";
+    }
+
+    // Removes the least recently used proofs until the cache is within its limit
+    void evict()
+    {
+        while (entries.size() > maxEntries)
+        {
+            auto lru = entries.begin();
+            for (auto it = entries.begin(); it != entries.end(); ++it)
+            {
+                if (it->second < lru->second)
+                {
+                    lru = it;
+                }
+            }
+            std::remove(getFilename(lru->first).c_str());
+            entries.erase(lru);
+        }
+    }
+
+    void load()
+    {
+        if (!isEnabled())
+        {
+            return;
+        }
+        mkdir(directory.c_str(), 0755);
+        DIR* dir = opendir(directory.c_str());
+        if (dir == nullptr)
+        {
+            std::cerr << "Cannot open proof cache directory: " << directory << std::endl;
+            return;
+        }
+        // Order the cached proofs by the time they were last used
+        std::multimap<time_t, std::string> byTime;
+        while (struct dirent* entry = readdir(dir))
+        {
+            std::string name = entry->d_name;
+            if (name.length() <= 5 || name.compare(name.length() - 5, 5, ".json") != 0)
+            {
+                continue;
+            }
+            struct stat st;
+            if (stat((directory + "/" + name).c_str(), &st) == 0)
+            {
+                byTime.insert(std::make_pair(st.st_mtime, name.substr(0, name.length() - 5)));
+            }
+        }
+        closedir(dir);
+        for (const auto& it : byTime)
+        {
+            entries[it.second] = ++useCounter;
+        }
+        evict();
+        std::cout << "Loaded " << entries.size() << " cached proofs" << std::endl;
+    }
+
+    const std::string directory;
+    const unsigned int maxEntries;
+
+    uint64_t useCounter;
+    // Key -> last use
+    std::map<std::string, uint64_t> entries;
+    mutable std::mutex mtx;
+};
+
+}
+
+#endif
@@ -0,0 +1,1021 @@
+#ifndef _PROVINGKEYIO_H_
+#define _PROVINGKEYIO_H_
+
+#include "ethsnarks.hpp"
+#include "HugePages.h"
+#include "MappedFile.h"
+
+#include <string>
+#include <vector>
+#include <random>
+#include <cstdio>
+#include <cstring>
+#include <future>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifdef MULTICORE
+#include <omp.h>
+#endif
+
+
+namespace Loopring
+{
+
+/**
+* Native proving key format.
+*
+* The group elements are stored exactly as they are laid out in memory (Montgomery form,
+* the coordinates as loaded by ethsnarks), so loading is a plain copy from the mapped file
+* without any parsing or conversion. Every section starts on a page boundary.
+*
+* The layout depends on the build (field and group element sizes are checked), and the
+* size and modification time of the raw pk it was converted from are stored so a native
+* pk that is out of date is never used.
+*/
+struct NativeProvingKeyHeader
+{
+    char magic[8];
+    uint32_t g1Size;
+    uint32_t g2Size;
+    uint64_t sourceSize;
+    uint64_t sourceTime;
+    uint64_t numA;
+    uint64_t numB;
+    uint64_t numH;
+    uint64_t numL;
+};
+
+static const char* NATIVE_PROVING_KEY_MAGIC = "LRCPK01";
+static const size_t NATIVE_PROVING_KEY_ALIGNMENT = 4096;
+
+typedef decltype(ethsnarks::ProvingKeyT().alpha_g1) NativeG1;
+typedef decltype(ethsnarks::ProvingKeyT().beta_g2) NativeG2;
+
+static std::string getNativeProvingKeyFilename(const std::string& rawFilename)
+{
+    std::string extension = ".raw";
+    if (rawFilename.length() > extension.length() &&
+        rawFilename.compare(rawFilename.length() - extension.length(), extension.length(), extension) == 0)
+    {
+        return rawFilename.substr(0, rawFilename.length() - extension.length()) + ".native";
+    }
+    return rawFilename + ".native";
+}
+
+static bool getFileInfo(const std::string& filename, uint64_t& size, uint64_t& time)
+{
+    struct stat st;
+    if (stat(filename.c_str(), &st) != 0)
+    {
+        return false;
+    }
+    size = uint64_t(st.st_size);
+    time = uint64_t(st.st_mtime);
+    return true;
+}
+
+static size_t alignSection(size_t offset)
+{
+    return (offset + NATIVE_PROVING_KEY_ALIGNMENT - 1) / NATIVE_PROVING_KEY_ALIGNMENT * NATIVE_PROVING_KEY_ALIGNMENT;
+}
+
+// Pads the file up to the start of the next section
+static bool beginSection(FILE* file, size_t& offset)
+{
+    size_t start = alignSection(offset);
+    std::vector<char> padding(start - offset, 0);
+    offset = start;
+    return fwrite(padding.data(), 1, padding.size(), file) == padding.size();
+}
+
+template<typename T>
+static bool writeSection(FILE* file, size_t& offset, const T* data, size_t count)
+{
+    if (!beginSection(file, offset) || fwrite(data, sizeof(T), count, file) != count)
+    {
+        return false;
+    }
+    offset += sizeof(T) * count;
+    return true;
+}
+
+// Copies a section of the mapped file in parallel
+template<typename T>
+static void readSection(const uint8_t* data, size_t& offset, T* out, size_t count)
+{
+    offset = alignSection(offset);
+    const uint8_t* src = data + offset;
+    size_t numBytes = sizeof(T) * count;
+    const size_t chunkSize = 1 << 24;
+    const size_t numChunks = (numBytes + chunkSize - 1) / chunkSize;
+#ifdef MULTICORE
+    #pragma omp parallel for
+#endif
+    for (size_t i = 0; i < numChunks; i++)
+    {
+        size_t begin = i * chunkSize;
+        memcpy(reinterpret_cast<uint8_t*>(out) + begin, src + begin, std::min(chunkSize, numBytes - begin));
+    }
+    offset += numBytes;
+}
+
+// Writes a loaded proving key in the native format
+static bool writeNativeProvingKey(const ethsnarks::ProvingKeyT& pk, const std::string& sourceFilename, const std::string& filename)
+{
+    NativeProvingKeyHeader header;
+    memset(&header, 0, sizeof(header));
+    strncpy(header.magic, NATIVE_PROVING_KEY_MAGIC, sizeof(header.magic));
+    header.g1Size = sizeof(NativeG1);
+    header.g2Size = sizeof(NativeG2);
+    if (!getFileInfo(sourceFilename, header.sourceSize, header.sourceTime))
+    {
+        std::cerr << "Cannot find source pk: " << sourceFilename << std::endl;
+        return false;
+    }
+    header.numA = pk.A_query.size();
+    header.numB = pk.B_query.size();
+    header.numH = pk.H_query.size();
+    header.numL = pk.L_query.size();
+
+    std::string tmpFilename = filename + ".tmp";
+    FILE* file = fopen(tmpFilename.c_str(), "wb");
+    if (file == nullptr)
+    {
+        std::cerr << "Cannot create native pk: " << tmpFilename << std::endl;
+        return false;
+    }
+    size_t offset = 0;
+    bool ok = writeSection(file, offset, &header, 1) &&
+              writeSection(file, offset, &pk.alpha_g1, 1) &&
+              writeSection(file, offset, &pk.beta_g1, 1) &&
+              writeSection(file, offset, &pk.beta_g2, 1) &&
+              writeSection(file, offset, &pk.delta_g1, 1) &&
+              writeSection(file, offset, &pk.delta_g2, 1) &&
+              writeSection(file, offset, pk.A_query.data(), pk.A_query.size()) &&
+              writeSection(file, offset, pk.B_query.data(), pk.B_query.size()) &&
+              writeSection(file, offset, pk.H_query.data(), pk.H_query.size()) &&
+              writeSection(file, offset, pk.L_query.data(), pk.L_query.size());
+    ok = (fclose(file) == 0) && ok;
+    if (!ok || std::rename(tmpFilename.c_str(), filename.c_str()) != 0)
+    {
+        std::cerr << "Failed to write native pk: " << filename << std::endl;
+        std::remove(tmpFilename.c_str());
+        return false;
+    }
+    return true;
+}
+
+// Returns true if the native pk exists and was converted from the current raw pk
+static bool isNativeProvingKeyValid(const std::string& filename, const std::string& sourceFilename)
+{
+    FILE* file = fopen(filename.c_str(), "rb");
+    if (file == nullptr)
+    {
+        return false;
+    }
+    NativeProvingKeyHeader header;
+    bool ok = fread(&header, sizeof(header), 1, file) == 1;
+    fclose(file);
+    uint64_t sourceSize = 0;
+    uint64_t sourceTime = 0;
+    bool hasSource = getFileInfo(sourceFilename, sourceSize, sourceTime);
+    return ok && strncmp(header.magic, NATIVE_PROVING_KEY_MAGIC, sizeof(header.magic)) == 0 &&
+           header.g1Size == sizeof(NativeG1) && header.g2Size == sizeof(NativeG2) &&
+           (!hasSource || (header.sourceSize == sourceSize && header.sourceTime == sourceTime));
+}
+
+// Copy constructs the points of a section straight from the mapped file, so they are
+// never default constructed first
+template<typename T>
+static void assignSection(const uint8_t* data, size_t& offset, std::vector<T>& out, size_t count)
+{
+    offset = alignSection(offset);
+    const T* src = reinterpret_cast<const T*>(data + offset);
+    reserveHugePages(out, count);
+    out.assign(src, src + count);
+    offset += sizeof(T) * count;
+}
+
+// The queries are advised to use huge pages before they are filled in. Constructing the
+// points is done for every query on its own thread.
+static void resizeQueries(ethsnarks::ProvingKeyT& pk, size_t numA, size_t numB, size_t numH, size_t numL)
+{
+    std::future<void> a = std::async(std::launch::async, [&]() {
+        reserveHugePages(pk.A_query, numA);
+        pk.A_query.resize(numA);
+    });
+    std::future<void> b = std::async(std::launch::async, [&]() {
+        reserveHugePages(pk.B_query, numB);
+        pk.B_query.resize(numB);
+    });
+    std::future<void> h = std::async(std::launch::async, [&]() {
+        reserveHugePages(pk.H_query, numH);
+        pk.H_query.resize(numH);
+    });
+    reserveHugePages(pk.L_query, numL);
+    pk.L_query.resize(numL);
+    a.get();
+    b.get();
+    h.get();
+}
+
+// Reads the header of a mapped native pk and checks the file holds all sections
+static bool readNativeProvingKeyHeader(const MappedFile& file, NativeProvingKeyHeader& header)
+{
+    if (file.size < sizeof(NativeProvingKeyHeader))
+    {
+        return false;
+    }
+    memcpy(&header, file.data, sizeof(header));
+    size_t end = sizeof(header);
+    end = alignSection(end) + sizeof(NativeG1);
+    end = alignSection(end) + sizeof(NativeG1);
+    end = alignSection(end) + sizeof(NativeG2);
+    end = alignSection(end) + sizeof(NativeG1);
+    end = alignSection(end) + sizeof(NativeG2);
+    end = alignSection(end) + sizeof(NativeG1) * header.numA;
+    end = alignSection(end) + sizeof(NativeG2) * header.numB;
+    end = alignSection(end) + sizeof(NativeG1) * header.numH;
+    end = alignSection(end) + sizeof(NativeG1) * header.numL;
+    return strncmp(header.magic, NATIVE_PROVING_KEY_MAGIC, sizeof(header.magic)) == 0 &&
+           header.g1Size == sizeof(NativeG1) && header.g2Size == sizeof(NativeG2) && end <= file.size;
+}
+
+// Maps the native pk and copies it straight into the proving key
+static bool loadNativeProvingKey(const std::string& filename, ethsnarks::ProvingKeyT& pk)
+{
+    MappedFile file;
+    NativeProvingKeyHeader header;
+    if (!file.open(filename))
+    {
+        return false;
+    }
+    if (!readNativeProvingKeyHeader(file, header))
+    {
+        std::cerr << "Invalid native pk: " << filename << std::endl;
+        return false;
+    }
+    const uint8_t* data = file.data;
+
+    size_t offset = sizeof(header);
+    readSection(data, offset, &pk.alpha_g1, 1);
+    readSection(data, offset, &pk.beta_g1, 1);
+    readSection(data, offset, &pk.beta_g2, 1);
+    readSection(data, offset, &pk.delta_g1, 1);
+    readSection(data, offset, &pk.delta_g2, 1);
+    // The section offsets are known up front (checked by readNativeProvingKeyHeader),
+    // so every query is copied on its own thread
+    size_t offsetA = offset;
+    size_t offsetB = alignSection(offsetA) + sizeof(NativeG1) * header.numA;
+    size_t offsetH = alignSection(offsetB) + sizeof(NativeG2) * header.numB;
+    size_t offsetL = alignSection(offsetH) + sizeof(NativeG1) * header.numH;
+    std::future<void> a = std::async(std::launch::async, [&]() {
+        assignSection(data, offsetA, pk.A_query, header.numA);
+    });
+    std::future<void> b = std::async(std::launch::async, [&]() {
+        assignSection(data, offsetB, pk.B_query, header.numB);
+    });
+    std::future<void> h = std::async(std::launch::async, [&]() {
+        assignSection(data, offsetH, pk.H_query, header.numH);
+    });
+    assignSection(data, offsetL, pk.L_query, header.numL);
+    a.get();
+    b.get();
+    h.get();
+    return true;
+}
+
+/**
+* Compressed proving key format.
+*
+* Points are stored as their affine x coordinate (in Montgomery form) with the sign of y
+* and the point at infinity encoded in the two unused top bits of the last limb. y is
+* recomputed from the curve equation when loading. The queries are split in chunks that
+* are decompressed independently in parallel.
+*
+* In the sparse variant the points at infinity (variables that never appear in A or B)
+* are not stored. Each query is preceded by a bitmap of the points that are stored.
+*/
+struct CompressedProvingKeyHeader
+{
+    char magic[8];
+    uint32_t fqSize;
+    uint32_t chunkSize;
+    uint64_t numA;
+    uint64_t numB;
+    uint64_t numH;
+    uint64_t numL;
+};
+
+static const char* COMPRESSED_PROVING_KEY_MAGIC = "LRCPKC1";
+static const char* SPARSE_PROVING_KEY_MAGIC = "LRCPKS1";
+static const uint32_t COMPRESSED_PROVING_KEY_CHUNK_SIZE = 1 << 14;
+
+typedef decltype(NativeG1().X) NativeFq;
+typedef decltype(NativeG2().X) NativeFq2;
+
+static const libff::mp_limb_t POINT_FLAG_INFINITY = libff::mp_limb_t(1) << (sizeof(libff::mp_limb_t) * 8 - 1);
+static const libff::mp_limb_t POINT_FLAG_SIGN = libff::mp_limb_t(1) << (sizeof(libff::mp_limb_t) * 8 - 2);
+static_assert(libff::alt_bn128_q_bitcount <= NativeFq::num_limbs * sizeof(libff::mp_limb_t) * 8 - 2,
+              "The top two bits of the last limb of a coordinate are used for the point flags");
+
+static std::string getCompressedProvingKeyFilename(const std::string& rawFilename)
+{
+    std::string native = getNativeProvingKeyFilename(rawFilename);
+    return native.substr(0, native.length() - 7) + ".compressed";
+}
+
+static bool isOdd(const NativeFq& value)
+{
+    return (value.as_bigint().data[0] & 1) != 0;
+}
+
+static bool isOdd(const NativeFq2& value)
+{
+    return value.c1.is_zero() ? isOdd(value.c0) : isOdd(value.c1);
+}
+
+static libff::mp_limb_t& getFlagLimb(NativeFq& value)
+{
+    return value.mont_repr.data[NativeFq::num_limbs - 1];
+}
+
+static libff::mp_limb_t& getFlagLimb(NativeFq2& value)
+{
+    return getFlagLimb(value.c1);
+}
+
+// Euler's criterion (the square root is only computed for values that have one,
+// Tonelli-Shanks does not terminate otherwise)
+static bool isSquare(const NativeFq& value)
+{
+    return value.is_zero() || (value ^ NativeFq::euler) == NativeFq::one();
+}
+
+// An element of Fq2 is a square iff its norm in Fq is a square
+static bool isSquare(const NativeFq2& value)
+{
+    return isSquare(value.c0.squared() - NativeFq2::non_residue * value.c1.squared());
+}
+
+template<typename PointT, typename CoordinateT>
+static void compressPoint(const PointT& point, CoordinateT& x)
+{
+    if (point.is_zero())
+    {
+        x = CoordinateT::zero();
+        getFlagLimb(x) |= POINT_FLAG_INFINITY;
+        return;
+    }
+    PointT affine = point;
+    affine.to_affine_coordinates();
+    x = affine.X;
+    if (isOdd(affine.Y))
+    {
+        getFlagLimb(x) |= POINT_FLAG_SIGN;
+    }
+}
+
+// Returns false if x is not on the curve
+template<typename PointT, typename CoordinateT>
+static bool decompressPoint(CoordinateT x, PointT& point)
+{
+    libff::mp_limb_t flags = getFlagLimb(x);
+    getFlagLimb(x) &= ~(POINT_FLAG_INFINITY | POINT_FLAG_SIGN);
+    if (flags & POINT_FLAG_INFINITY)
+    {
+        point = PointT::zero();
+        return true;
+    }
+    CoordinateT y2 = x.squared() * x + PointT::coeff_b;
+    if (!isSquare(y2))
+    {
+        return false;
+    }
+    CoordinateT y = y2.sqrt();
+    if (isOdd(y) != ((flags & POINT_FLAG_SIGN) != 0))
+    {
+        y = -y;
+    }
+    point.X = x;
+    point.Y = y;
+    point.Z = decltype(point.Z)::one();
+    return true;
+}
+
+template<typename PointT, typename CoordinateT>
+static bool writeCompressedPoints(FILE* file, const PointT* points, size_t count, bool sparse)
+{
+    std::vector<uint64_t> bitmap((count + 63) / 64, 0);
+    std::vector<CoordinateT> compressed;
+    compressed.reserve(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        if (!sparse || !points[i].is_zero())
+        {
+            bitmap[i / 64] |= uint64_t(1) << (i % 64);
+            compressed.push_back(CoordinateT());
+        }
+    }
+    // Compress in parallel, the points keep their order
+    std::vector<size_t> indices;
+    indices.reserve(compressed.size());
+    for (size_t i = 0; i < count; i++)
+    {
+        if (bitmap[i / 64] & (uint64_t(1) << (i % 64)))
+        {
+            indices.push_back(i);
+        }
+    }
+#ifdef MULTICORE
+    #pragma omp parallel for
+#endif
+    for (size_t j = 0; j < indices.size(); j++)
+    {
+        compressPoint(points[indices[j]], compressed[j]);
+    }
+    if (sparse && fwrite(bitmap.data(), sizeof(uint64_t), bitmap.size(), file) != bitmap.size())
+    {
+        return false;
+    }
+    return fwrite(compressed.data(), sizeof(CoordinateT), compressed.size(), file) == compressed.size();
+}
+
+/**
+* The points of a query in a mapped compressed pk. Chunks of points can be decompressed
+* independently, and single points can be looked up without decompressing the rest.
+*/
+template<typename PointT, typename CoordinateT>
+class CompressedQuery
+{
+public:
+    CompressedQuery() :
+        count(0),
+        sparse(false),
+        bitmap(nullptr),
+        compressed(nullptr)
+    {
+
+    }
+
+    // Finds where the stored points of every chunk start
+    bool parse(const MappedFile& file, size_t& offset, size_t _count, bool _sparse)
+    {
+        count = _count;
+        sparse = _sparse;
+        const size_t numChunks = getNumChunks();
+        chunkStart.assign(numChunks + 1, 0);
+        if (sparse)
+        {
+            size_t numWords = (count + 63) / 64;
+            if (offset + numWords * sizeof(uint64_t) > file.size)
+            {
+                return false;
+            }
+            bitmap = reinterpret_cast<const uint64_t*>(file.data + offset);
+            offset += numWords * sizeof(uint64_t);
+            for (size_t c = 0; c < numChunks; c++)
+            {
+                size_t stored = 0;
+                size_t end = std::min(numWords, (c + 1) * COMPRESSED_PROVING_KEY_CHUNK_SIZE / 64);
+                for (size_t w = c * COMPRESSED_PROVING_KEY_CHUNK_SIZE / 64; w < end; w++)
+                {
+                    stored += __builtin_popcountll(bitmap[w]);
+                }
+                chunkStart[c + 1] = chunkStart[c] + stored;
+            }
+        }
+        else
+        {
+            for (size_t c = 0; c < numChunks; c++)
+            {
+                chunkStart[c + 1] = std::min(count, (c + 1) * COMPRESSED_PROVING_KEY_CHUNK_SIZE);
+            }
+        }
+        if (offset + chunkStart[numChunks] * sizeof(CoordinateT) > file.size)
+        {
+            return false;
+        }
+        compressed = reinterpret_cast<const CoordinateT*>(file.data + offset);
+        offset += chunkStart[numChunks] * sizeof(CoordinateT);
+        return true;
+    }
+
+    size_t getNumChunks() const
+    {
+        return (count + COMPRESSED_PROVING_KEY_CHUNK_SIZE - 1) / COMPRESSED_PROVING_KEY_CHUNK_SIZE;
+    }
+
+    // Where the stored points of chunk c start in the file (c == getNumChunks() is the end of the query)
+    const uint8_t* getChunkData(size_t c) const
+    {
+        return reinterpret_cast<const uint8_t*>(compressed + chunkStart[c]);
+    }
+
+    // Decompresses the chunks [begin, end) in parallel, the first point of chunk 'begin' is stored
+    // in points[0]. Returns the number of points that are not on the curve.
+    size_t decompress(size_t begin, size_t end, PointT* points) const
+    {
+        const size_t first = begin * COMPRESSED_PROVING_KEY_CHUNK_SIZE;
+        size_t numInvalid = 0;
+#ifdef MULTICORE
+        #pragma omp parallel for schedule(dynamic) reduction(+:numInvalid)
+#endif
+        for (size_t c = begin; c < end; c++)
+        {
+            size_t j = chunkStart[c];
+            size_t last = std::min(count, (c + 1) * COMPRESSED_PROVING_KEY_CHUNK_SIZE);
+            for (size_t i = c * COMPRESSED_PROVING_KEY_CHUNK_SIZE; i < last; i++)
+            {
+                if (sparse && !isStored(i))
+                {
+                    points[i - first] = PointT::zero();
+                }
+                else if (!decompressPoint(compressed[j++], points[i - first]))
+                {
+                    numInvalid++;
+                }
+            }
+        }
+        return numInvalid;
+    }
+
+    // Decompresses a single point
+    bool getPoint(size_t i, PointT& point) const
+    {
+        if (sparse && !isStored(i))
+        {
+            point = PointT::zero();
+            return true;
+        }
+        size_t j = i;
+        if (sparse)
+        {
+            // Count the stored points in the chunk before this point
+            size_t c = i / COMPRESSED_PROVING_KEY_CHUNK_SIZE;
+            j = chunkStart[c];
+            for (size_t w = c * COMPRESSED_PROVING_KEY_CHUNK_SIZE / 64; w < i / 64; w++)
+            {
+                j += __builtin_popcountll(bitmap[w]);
+            }
+            j += __builtin_popcountll(bitmap[i / 64] & ((uint64_t(1) << (i % 64)) - 1));
+        }
+        return decompressPoint(compressed[j], point);
+    }
+
+private:
+
+    bool isStored(size_t i) const
+    {
+        return (bitmap[i / 64] & (uint64_t(1) << (i % 64))) != 0;
+    }
+
+    size_t count;
+    bool sparse;
+    const uint64_t* bitmap;
+    const CoordinateT* compressed;
+    std::vector<size_t> chunkStart;
+};
+
+template<typename PointT, typename CoordinateT>
+static bool readCompressedPoints(const MappedFile& file, size_t& offset, PointT* points, size_t count, bool sparse)
+{
+    CompressedQuery<PointT, CoordinateT> query;
+    return query.parse(file, offset, count, sparse) &&
+           query.decompress(0, query.getNumChunks(), points) == 0;
+}
+
+template<typename PointT>
+static size_t countZeroPoints(const std::vector<PointT>& points)
+{
+    size_t numZero = 0;
+    for (const PointT& point : points)
+    {
+        numZero += point.is_zero() ? 1 : 0;
+    }
+    return numZero;
+}
+
+// Writes a loaded proving key in the compressed format (without the points at infinity when sparse)
+static bool writeCompressedProvingKey(const ethsnarks::ProvingKeyT& pk, const std::string& filename, bool sparse = false)
+{
+    CompressedProvingKeyHeader header;
+    memset(&header, 0, sizeof(header));
+    strncpy(header.magic, sparse ? SPARSE_PROVING_KEY_MAGIC : COMPRESSED_PROVING_KEY_MAGIC, sizeof(header.magic));
+    header.fqSize = sizeof(NativeFq);
+    header.chunkSize = COMPRESSED_PROVING_KEY_CHUNK_SIZE;
+    header.numA = pk.A_query.size();
+    header.numB = pk.B_query.size();
+    header.numH = pk.H_query.size();
+    header.numL = pk.L_query.size();
+    if (sparse)
+    {
+        std::cout << "Points at infinity: A: " << countZeroPoints(pk.A_query) << "/" << pk.A_query.size()
+                  << "; B: " << countZeroPoints(pk.B_query) << "/" << pk.B_query.size()
+                  << "; H: " << countZeroPoints(pk.H_query) << "/" << pk.H_query.size()
+                  << "; L: " << countZeroPoints(pk.L_query) << "/" << pk.L_query.size() << std::endl;
+    }
+
+    std::string tmpFilename = filename + ".tmp";
+    FILE* file = fopen(tmpFilename.c_str(), "wb");
+    if (file == nullptr)
+    {
+        std::cerr << "Cannot create compressed pk: " << tmpFilename << std::endl;
+        return false;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+              writeCompressedPoints<NativeG1, NativeFq>(file, &pk.alpha_g1, 1, false) &&
+              writeCompressedPoints<NativeG1, NativeFq>(file, &pk.beta_g1, 1, false) &&
+              writeCompressedPoints<NativeG2, NativeFq2>(file, &pk.beta_g2, 1, false) &&
+              writeCompressedPoints<NativeG1, NativeFq>(file, &pk.delta_g1, 1, false) &&
+              writeCompressedPoints<NativeG2, NativeFq2>(file, &pk.delta_g2, 1, false) &&
+              writeCompressedPoints<NativeG1, NativeFq>(file, pk.A_query.data(), pk.A_query.size(), sparse) &&
+              writeCompressedPoints<NativeG2, NativeFq2>(file, pk.B_query.data(), pk.B_query.size(), sparse) &&
+              writeCompressedPoints<NativeG1, NativeFq>(file, pk.H_query.data(), pk.H_query.size(), sparse) &&
+              writeCompressedPoints<NativeG1, NativeFq>(file, pk.L_query.data(), pk.L_query.size(), sparse);
+    ok = (fclose(file) == 0) && ok;
+    if (!ok || std::rename(tmpFilename.c_str(), filename.c_str()) != 0)
+    {
+        std::cerr << "Failed to write compressed pk: " << filename << std::endl;
+        std::remove(tmpFilename.c_str());
+        return false;
+    }
+    return true;
+}
+
+// Reads the header of a mapped compressed (or sparse) pk
+static bool readCompressedProvingKeyHeader(const MappedFile& file, CompressedProvingKeyHeader& header, bool& sparse)
+{
+    if (file.size < sizeof(CompressedProvingKeyHeader))
+    {
+        return false;
+    }
+    memcpy(&header, file.data, sizeof(header));
+    sparse = strncmp(header.magic, SPARSE_PROVING_KEY_MAGIC, sizeof(header.magic)) == 0;
+    return (sparse || strncmp(header.magic, COMPRESSED_PROVING_KEY_MAGIC, sizeof(header.magic)) == 0) &&
+           header.fqSize == sizeof(NativeFq) && header.chunkSize == COMPRESSED_PROVING_KEY_CHUNK_SIZE;
+}
+
+// Loads a compressed (or sparse) proving key, the points are decompressed in parallel
+static bool loadCompressedProvingKey(const std::string& filename, ethsnarks::ProvingKeyT& pk)
+{
+    MappedFile file;
+    CompressedProvingKeyHeader header;
+    bool sparse = false;
+    if (!file.open(filename))
+    {
+        return false;
+    }
+    if (!readCompressedProvingKeyHeader(file, header, sparse))
+    {
+        std::cerr << "Invalid compressed pk: " << filename << std::endl;
+        return false;
+    }
+
+    resizeQueries(pk, header.numA, header.numB, header.numH, header.numL);
+    size_t offset = sizeof(header);
+    bool ok = readCompressedPoints<NativeG1, NativeFq>(file, offset, &pk.alpha_g1, 1, false) &&
+              readCompressedPoints<NativeG1, NativeFq>(file, offset, &pk.beta_g1, 1, false) &&
+              readCompressedPoints<NativeG2, NativeFq2>(file, offset, &pk.beta_g2, 1, false) &&
+              readCompressedPoints<NativeG1, NativeFq>(file, offset, &pk.delta_g1, 1, false) &&
+              readCompressedPoints<NativeG2, NativeFq2>(file, offset, &pk.delta_g2, 1, false) &&
+              readCompressedPoints<NativeG1, NativeFq>(file, offset, pk.A_query.data(), pk.A_query.size(), sparse) &&
+              readCompressedPoints<NativeG2, NativeFq2>(file, offset, pk.B_query.data(), pk.B_query.size(), sparse) &&
+              readCompressedPoints<NativeG1, NativeFq>(file, offset, pk.H_query.data(), pk.H_query.size(), sparse) &&
+              readCompressedPoints<NativeG1, NativeFq>(file, offset, pk.L_query.data(), pk.L_query.size(), sparse);
+    if (!ok || offset != file.size)
+    {
+        std::cerr << "Invalid compressed pk (truncated or points not on the curve): " << filename << std::endl;
+        return false;
+    }
+    return true;
+}
+
+
+// Number of chunks decompressed at a time when converting, bounds the memory used to 1M points
+static const size_t PROVING_KEY_CONVERT_BATCH_CHUNKS = 64;
+
+// Decompresses a query batch by batch straight into the native pk
+template<typename PointT, typename CoordinateT>
+static bool convertCompressedQuery(const MappedFile& in, size_t& inOffset, size_t count, bool sparse, FILE* out, size_t& outOffset)
+{
+    CompressedQuery<PointT, CoordinateT> query;
+    if (!query.parse(in, inOffset, count, sparse) || !beginSection(out, outOffset))
+    {
+        return false;
+    }
+    std::vector<PointT> batch;
+    const size_t numChunks = query.getNumChunks();
+    for (size_t c = 0; c < numChunks; c += PROVING_KEY_CONVERT_BATCH_CHUNKS)
+    {
+        size_t end = std::min(numChunks, c + PROVING_KEY_CONVERT_BATCH_CHUNKS);
+        batch.resize(std::min(count, end * COMPRESSED_PROVING_KEY_CHUNK_SIZE) - c * COMPRESSED_PROVING_KEY_CHUNK_SIZE);
+        if (query.decompress(c, end, batch.data()) != 0 ||
+            fwrite(batch.data(), sizeof(PointT), batch.size(), out) != batch.size())
+        {
+            return false;
+        }
+        in.release(query.getChunkData(c) - in.data, query.getChunkData(end) - in.data);
+    }
+    outOffset += sizeof(PointT) * count;
+    return true;
+}
+
+// Converts a compressed (or sparse) pk to the native format without loading the whole key in memory
+static bool convertCompressedToNativeProvingKey(const std::string& compressedFilename, const std::string& filename)
+{
+    MappedFile in;
+    CompressedProvingKeyHeader compressedHeader;
+    bool sparse = false;
+    if (!in.open(compressedFilename, false))
+    {
+        return false;
+    }
+    if (!readCompressedProvingKeyHeader(in, compressedHeader, sparse))
+    {
+        std::cerr << "Invalid compressed pk: " << compressedFilename << std::endl;
+        return false;
+    }
+
+    NativeProvingKeyHeader header;
+    memset(&header, 0, sizeof(header));
+    strncpy(header.magic, NATIVE_PROVING_KEY_MAGIC, sizeof(header.magic));
+    header.g1Size = sizeof(NativeG1);
+    header.g2Size = sizeof(NativeG2);
+    getFileInfo(compressedFilename, header.sourceSize, header.sourceTime);
+    header.numA = compressedHeader.numA;
+    header.numB = compressedHeader.numB;
+    header.numH = compressedHeader.numH;
+    header.numL = compressedHeader.numL;
+
+    ethsnarks::ProvingKeyT pk;
+    size_t inOffset = sizeof(compressedHeader);
+    bool ok = readCompressedPoints<NativeG1, NativeFq>(in, inOffset, &pk.alpha_g1, 1, false) &&
+              readCompressedPoints<NativeG1, NativeFq>(in, inOffset, &pk.beta_g1, 1, false) &&
+              readCompressedPoints<NativeG2, NativeFq2>(in, inOffset, &pk.beta_g2, 1, false) &&
+              readCompressedPoints<NativeG1, NativeFq>(in, inOffset, &pk.delta_g1, 1, false) &&
+              readCompressedPoints<NativeG2, NativeFq2>(in, inOffset, &pk.delta_g2, 1, false);
+    if (!ok)
+    {
+        std::cerr << "Invalid compressed pk: " << compressedFilename << std::endl;
+        return false;
+    }
+
+    std::string tmpFilename = filename + ".tmp";
+    FILE* file = fopen(tmpFilename.c_str(), "wb");
+    if (file == nullptr)
+    {
+        std::cerr << "Cannot create native pk: " << tmpFilename << std::endl;
+        return false;
+    }
+    size_t offset = 0;
+    ok = writeSection(file, offset, &header, 1) &&
+         writeSection(file, offset, &pk.alpha_g1, 1) &&
+         writeSection(file, offset, &pk.beta_g1, 1) &&
+         writeSection(file, offset, &pk.beta_g2, 1) &&
+         writeSection(file, offset, &pk.delta_g1, 1) &&
+         writeSection(file, offset, &pk.delta_g2, 1) &&
+         convertCompressedQuery<NativeG1, NativeFq>(in, inOffset, header.numA, sparse, file, offset) &&
+         convertCompressedQuery<NativeG2, NativeFq2>(in, inOffset, header.numB, sparse, file, offset) &&
+         convertCompressedQuery<NativeG1, NativeFq>(in, inOffset, header.numH, sparse, file, offset) &&
+         convertCompressedQuery<NativeG1, NativeFq>(in, inOffset, header.numL, sparse, file, offset) &&
+         inOffset == in.size;
+    ok = (fclose(file) == 0) && ok;
+    if (!ok || std::rename(tmpFilename.c_str(), filename.c_str()) != 0)
+    {
+        std::cerr << "Failed to convert compressed pk (truncated or points not on the curve): " << compressedFilename << std::endl;
+        std::remove(tmpFilename.c_str());
+        return false;
+    }
+    return true;
+}
+
+/**
+* Random access to the points of a proving key that is loaded in memory, or that is stored
+* in the native or compressed format (the file is mapped, not loaded). Used to spot-check
+* converted keys.
+*/
+class ProvingKeyReader
+{
+public:
+    ProvingKeyReader() :
+        pk(nullptr),
+        native(false)
+    {
+        memset(&nativeHeader, 0, sizeof(nativeHeader));
+    }
+
+    void open(const ethsnarks::ProvingKeyT& _pk)
+    {
+        pk = &_pk;
+        nativeHeader.numA = pk->A_query.size();
+        nativeHeader.numB = pk->B_query.size();
+        nativeHeader.numH = pk->H_query.size();
+        nativeHeader.numL = pk->L_query.size();
+    }
+
+    bool open(const std::string& filename)
+    {
+        if (!file.open(filename, false))
+        {
+            return false;
+        }
+        native = readNativeProvingKeyHeader(file, nativeHeader);
+        if (native)
+        {
+            size_t offset = sizeof(nativeHeader);
+            readSection(file.data, offset, &fixed.alpha_g1, 1);
+            readSection(file.data, offset, &fixed.beta_g1, 1);
+            readSection(file.data, offset, &fixed.beta_g2, 1);
+            readSection(file.data, offset, &fixed.delta_g1, 1);
+            readSection(file.data, offset, &fixed.delta_g2, 1);
+            for (unsigned int q = 0; q < 4; q++)
+            {
+                offset = alignSection(offset);
+                queryOffset[q] = offset;
+                offset += getQuerySize(q) * (q == 1 ? sizeof(NativeG2) : sizeof(NativeG1));
+            }
+            return true;
+        }
+
+        CompressedProvingKeyHeader header;
+        bool sparse = false;
+        size_t offset = sizeof(header);
+        bool ok = readCompressedProvingKeyHeader(file, header, sparse) &&
+                  readCompressedPoints<NativeG1, NativeFq>(file, offset, &fixed.alpha_g1, 1, false) &&
+                  readCompressedPoints<NativeG1, NativeFq>(file, offset, &fixed.beta_g1, 1, false) &&
+                  readCompressedPoints<NativeG2, NativeFq2>(file, offset, &fixed.beta_g2, 1, false) &&
+                  readCompressedPoints<NativeG1, NativeFq>(file, offset, &fixed.delta_g1, 1, false) &&
+                  readCompressedPoints<NativeG2, NativeFq2>(file, offset, &fixed.delta_g2, 1, false) &&
+                  compressedA.parse(file, offset, header.numA, sparse) &&
+                  compressedB.parse(file, offset, header.numB, sparse) &&
+                  compressedH.parse(file, offset, header.numH, sparse) &&
+                  compressedL.parse(file, offset, header.numL, sparse);
+        if (!ok)
+        {
+            std::cerr << "Not a native or compressed pk: " << filename << std::endl;
+            return false;
+        }
+        nativeHeader.numA = header.numA;
+        nativeHeader.numB = header.numB;
+        nativeHeader.numH = header.numH;
+        nativeHeader.numL = header.numL;
+        return true;
+    }
+
+    const ethsnarks::ProvingKeyT& getFixedPoints() const
+    {
+        return (pk != nullptr) ? *pk : fixed;
+    }
+
+    // Number of points in query q (A, B, H, L)
+    size_t getQuerySize(unsigned int q) const
+    {
+        const uint64_t sizes[] = {nativeHeader.numA, nativeHeader.numB, nativeHeader.numH, nativeHeader.numL};
+        return sizes[q];
+    }
+
+    bool getA(size_t i, NativeG1& point) const
+    {
+        return (pk != nullptr) ? copy(pk->A_query[i], point) : native ? readNative(0, i, point) : compressedA.getPoint(i, point);
+    }
+
+    bool getB(size_t i, NativeG2& point) const
+    {
+        return (pk != nullptr) ? copy(pk->B_query[i], point) : native ? readNative(1, i, point) : compressedB.getPoint(i, point);
+    }
+
+    bool getH(size_t i, NativeG1& point) const
+    {
+        return (pk != nullptr) ? copy(pk->H_query[i], point) : native ? readNative(2, i, point) : compressedH.getPoint(i, point);
+    }
+
+    bool getL(size_t i, NativeG1& point) const
+    {
+        return (pk != nullptr) ? copy(pk->L_query[i], point) : native ? readNative(3, i, point) : compressedL.getPoint(i, point);
+    }
+
+private:
+
+    template<typename PointT>
+    static bool copy(const PointT& src, PointT& dst)
+    {
+        dst = src;
+        return true;
+    }
+
+    template<typename PointT>
+    bool readNative(unsigned int q, size_t i, PointT& point) const
+    {
+        memcpy(&point, file.data + queryOffset[q] + i * sizeof(PointT), sizeof(PointT));
+        return true;
+    }
+
+    const ethsnarks::ProvingKeyT* pk;
+    MappedFile file;
+    bool native;
+    NativeProvingKeyHeader nativeHeader;
+    size_t queryOffset[4];
+    ethsnarks::ProvingKeyT fixed;
+    CompressedQuery<NativeG1, NativeFq> compressedA;
+    CompressedQuery<NativeG2, NativeFq2> compressedB;
+    CompressedQuery<NativeG1, NativeFq> compressedH;
+    CompressedQuery<NativeG1, NativeFq> compressedL;
+};
+
+// Number of random points checked per query after a conversion
+static const size_t PROVING_KEY_VERIFY_SAMPLES = 1000;
+
+// The point is on the curve and in the prime order subgroup
+template<typename PointT>
+static bool isValidPoint(const PointT& point)
+{
+    return point.is_well_formed() && (PointT::order() * point).is_zero();
+}
+
+// Compares the first, the last and 'numSamples' random points of a query, the points of the converted
+// key also need to be valid points. Returns the number of mismatches.
+template<typename PointT>
+static size_t spotCheckQuery(const ProvingKeyReader& expected, const ProvingKeyReader& actual,
+                             bool (ProvingKeyReader::*getPoint)(size_t, PointT&) const,
+                             size_t count, size_t numSamples, std::mt19937_64& rng)
+{
+    if (count == 0)
+    {
+        return 0;
+    }
+    std::vector<size_t> indices = {0, count - 1};
+    std::uniform_int_distribution<size_t> distribution(0, count - 1);
+    for (size_t s = 0; s < numSamples; s++)
+    {
+        indices.push_back(distribution(rng));
+    }
+    size_t numMismatches = 0;
+    for (size_t i : indices)
+    {
+        PointT a;
+        PointT b;
+        if (!(expected.*getPoint)(i, a) || !(actual.*getPoint)(i, b) || !(a == b) || !isValidPoint(b))
+        {
+            numMismatches++;
+        }
+    }
+    return numMismatches;
+}
+
+// Spot-checks that a converted proving key holds the same points as the key it was converted from
+static bool verifyProvingKey(const ProvingKeyReader& expected, const ProvingKeyReader& actual, size_t numSamples = PROVING_KEY_VERIFY_SAMPLES)
+{
+    for (unsigned int q = 0; q < 4; q++)
+    {
+        if (expected.getQuerySize(q) != actual.getQuerySize(q))
+        {
+            std::cerr << "Proving key query sizes don't match!" << std::endl;
+            return false;
+        }
+    }
+    const ethsnarks::ProvingKeyT& a = expected.getFixedPoints();
+    const ethsnarks::ProvingKeyT& b = actual.getFixedPoints();
+    size_t numMismatches = (a.alpha_g1 == b.alpha_g1 && a.beta_g1 == b.beta_g1 && a.beta_g2 == b.beta_g2 &&
+                            a.delta_g1 == b.delta_g1 && a.delta_g2 == b.delta_g2 &&
+                            isValidPoint(b.alpha_g1) && isValidPoint(b.beta_g1) && isValidPoint(b.beta_g2) &&
+                            isValidPoint(b.delta_g1) && isValidPoint(b.delta_g2)) ? 0 : 1;
+    std::mt19937_64 rng(std::random_device{}());
+    numMismatches += spotCheckQuery(expected, actual, &ProvingKeyReader::getA, expected.getQuerySize(0), numSamples, rng);
+    numMismatches += spotCheckQuery(expected, actual, &ProvingKeyReader::getB, expected.getQuerySize(1), numSamples, rng);
+    numMismatches += spotCheckQuery(expected, actual, &ProvingKeyReader::getH, expected.getQuerySize(2), numSamples, rng);
+    numMismatches += spotCheckQuery(expected, actual, &ProvingKeyReader::getL, expected.getQuerySize(3), numSamples, rng);
+    if (numMismatches != 0)
+    {
+        std::cerr << "Converted proving key does not match: " << numMismatches << " points differ or are invalid" << std::endl;
+        return false;
+    }
+    std::cout << "Spot-checked the converted proving key (" << numSamples << " random points per query)" << std::endl;
+    return true;
+}
+
+
+// Spot-checks a converted pk file against the loaded key it was converted from
+static bool verifyProvingKey(const ethsnarks::ProvingKeyT& pk, const std::string& filename)
+{
+    ProvingKeyReader expected;
+    ProvingKeyReader actual;
+    expected.open(pk);
+    return actual.open(filename) && verifyProvingKey(expected, actual);
+}
+
+// Spot-checks a converted pk file against the native or compressed pk file it was converted from.
+// Both files are decoded by the code in this file, so prefer checking against the raw pk when it's available.
+static bool verifyProvingKey(const std::string& sourceFilename, const std::string& filename)
+{
+    ProvingKeyReader expected;
+    ProvingKeyReader actual;
+    return expected.open(sourceFilename) && actual.open(filename) && verifyProvingKey(expected, actual);
+}
+
+}
+
+#endif
@@ -1,5 +1,8 @@
 #include <string>
 #include <chrono>
+#include <vector>
+#include <cstring>
+#include <algorithm>
 
 #define NDEBUG 1
 
@@ -73,6 +76,81 @@ struct ec_type<alt_bn128_libsnark> {
 };
 
 
+// Host side operations on the results of the multiexps
+template< typename B, typename EC >
+struct ec_result;
+
+template<>
+struct ec_result<alt_bn128_libsnark, ECp_ALT_BN128> {
+    typedef alt_bn128_libsnark B;
+    typedef B::G1 point;
+    static point *read(const var *mem) { return B::read_pt_ECp(mem); }
+    static point *add(point *a, point *b) { return B::G1_add(a, b); }
+    static void destroy(point *a) { B::delete_G1(a); }
+};
+
+template<>
+struct ec_result<alt_bn128_libsnark, ECp2_ALT_BN128> {
+    typedef alt_bn128_libsnark B;
+    typedef B::G2 point;
+    static point *read(const var *mem) { return B::read_pt_ECpe(mem); }
+    static point *add(point *a, point *b) { return B::G2_add(a, b); }
+    static void destroy(point *a) { B::delete_G2(a); }
+};
+
+// Multiexp of a query with N points without loading all of its multiples in memory.
+// The multiples are read from the preprocessed file in chunks that fit in
+// 'memory_budget' bytes. The next chunk is read from disk while the current chunk
+// is reduced on the GPU, the partial results are added on the host.
+template< typename B, typename EC, int C, int R >
+typename ec_result<B, EC>::point *
+multiexp_streamed(FILE *preprocessed_file, off_t offset, const var *scalars, size_t N, size_t memory_budget)
+{
+    typedef ec_result<B, EC> result_ops;
+    static constexpr size_t aff_pt_bytes = 2 * EC::field_type::DEGREE * ELT_BYTES;
+    static constexpr size_t num_multiples = (1U << C) - 1;
+
+    // The budget holds the chunk on the device and the next chunk read on the host
+    size_t chunk_size = memory_budget / (2 * num_multiples * aff_pt_bytes);
+    chunk_size = std::min(N, std::max(chunk_size, size_t(R)));
+    size_t chunk_bytes = num_multiples * chunk_size * aff_pt_bytes;
+
+    auto mults = allocate_memory(chunk_bytes);
+    auto out = allocate_memory(((chunk_size + R - 1) / R) * EC::NELTS * ELT_BYTES);
+    std::vector<char> next(chunk_bytes);
+
+    cudaStream_t strm;
+    cudaStreamCreate(&strm);
+
+    typename result_ops::point *result = nullptr;
+    load_points_affine_chunk<EC, C>(preprocessed_file, offset, N, 0, chunk_size, next.data());
+    for (size_t start = 0; start < N; start += chunk_size) {
+        size_t n = std::min(chunk_size, N - start);
+        // The chunk is compact: its windows are n points apart
+        memcpy(mults.get(), next.data(), num_multiples * n * aff_pt_bytes);
+        ec_reduce_straus_on_stream<EC, C, R>(strm, out.get(), mults.get(), scalars + start * ELT_LIMBS, n);
+
+        if (start + n < N) {
+            size_t next_n = std::min(chunk_size, N - start - n);
+            load_points_affine_chunk<EC, C>(preprocessed_file, offset, N, start + n, next_n, next.data());
+        }
+
+        cudaStreamSynchronize(strm);
+        auto partial = result_ops::read(out.get());
+        if (result == nullptr) {
+            result = partial;
+        } else {
+            auto sum = result_ops::add(result, partial);
+            result_ops::destroy(result);
+            result_ops::destroy(partial);
+            result = sum;
+        }
+    }
+
+    cudaStreamDestroy(strm);
+    return result;
+}
+
 void
 check_trailing(FILE *f, const char *name) {
     long bytes_remaining = 0;
@@ -96,12 +174,99 @@ print_time(T &t1, const char *str) {
     t1 = t2;
 }
 
+// Same as run_prover, but the precomputed multiples are streamed from the preprocessed
+// file within 'memory_budget' bytes instead of being loaded all at once. The queries are
+// reduced one after the other.
+template <typename B>
+void run_prover_streamed(
+        FILE *params_file,
+        const char *input_path,
+        const char *output_path,
+        FILE *preprocessed_file,
+        size_t memory_budget,
+        size_t d,
+        size_t orig_d,
+        size_t m)
+{
+    size_t primary_input_size = 1;
+
+    auto t = now();
+
+    typedef typename ec_type<B>::ECp ECp;
+    typedef typename ec_type<B>::ECpe ECpe;
+
+    static constexpr int R = 32;
+    static constexpr int C = 4;
+    static constexpr size_t num_multiples = (1U << C) - 1;
+    static constexpr size_t aff_G1_bytes = 2 * ECp::field_type::DEGREE * ELT_BYTES;
+    static constexpr size_t aff_G2_bytes = 2 * ECpe::field_type::DEGREE * ELT_BYTES;
+
+    // Offsets of the multiples of the queries in the preprocessed file
+    off_t offset_A = 0;
+    off_t offset_B1 = offset_A + off_t(num_multiples * (m + 1) * aff_G1_bytes);
+    off_t offset_B2 = offset_B1 + off_t(num_multiples * (m + 1) * aff_G1_bytes);
+    off_t offset_L = offset_B2 + off_t(num_multiples * (m + 1) * aff_G2_bytes);
+    off_t offset_H = offset_L + off_t(num_multiples * (m - 1) * aff_G1_bytes);
+
+    auto params = B::read_params(params_file, d, m);
+    fclose(params_file);
+    print_time(t, "load params");
+
+    auto t_main = t;
+
+    FILE *inputs_file = fopen(input_path, "r");
+    auto w_ = load_scalars(m + 1, inputs_file);
+    rewind(inputs_file);
+    auto inputs = B::read_input(inputs_file, d, orig_d + 1, m);
+    fclose(inputs_file);
+    print_time(t, "load inputs");
+
+    const var *w = w_.get();
+
+    auto coefficients_for_H =
+        compute_H<B>(orig_d, B::input_ca(inputs), B::input_cb(inputs), B::input_cc(inputs));
+    print_time(t, "coefficients_for_H");
+
+    auto H_coeff_mem = allocate_memory(d * ELT_BYTES);
+    B::coefficients_for_H_to_mem(coefficients_for_H, (uint8_t *)H_coeff_mem.get(), ELT_BYTES, d);
+    print_time(t, "coefficients_H_mem");
+
+    // B1 is not needed: only A, B2 and C (= H + L) are part of the proof
+    auto evaluation_At = multiexp_streamed<B, ECp, C, R>(preprocessed_file, offset_A, w, m + 1, memory_budget);
+    print_time(t, "multiexp A");
+    auto evaluation_Bt2 = multiexp_streamed<B, ECpe, C, 2*R>(preprocessed_file, offset_B2, w, m + 1, memory_budget);
+    print_time(t, "multiexp B2");
+    auto evaluation_Lt = multiexp_streamed<B, ECp, C, R>(preprocessed_file, offset_L, w + (primary_input_size + 1) * ELT_LIMBS, m - 1, memory_budget);
+    print_time(t, "multiexp L");
+    auto evaluation_Ht = multiexp_streamed<B, ECp, C, R>(preprocessed_file, offset_H, H_coeff_mem.get(), d, memory_budget);
+    print_time(t, "multiexp H");
+
+    auto final_At = B::G1_add(B::alpha_g1(params), evaluation_At);
+    auto final_Bt2 = B::G2_add(B::beta_g2(params), evaluation_Bt2);
+    auto final_C = B::G1_add(evaluation_Ht, evaluation_Lt);
+
+    B::groth16_output_write(final_At, final_Bt2, final_C, inputs, output_path);
+
+    print_time(t, "store");
+
+    print_time(t_main, "Total time from input to output: ");
+
+    B::delete_G1(evaluation_At);
+    B::delete_G2(evaluation_Bt2);
+    B::delete_G1(evaluation_Ht);
+    B::delete_G1(evaluation_Lt);
+    B::delete_vector_Fr(coefficients_for_H);
+    B::delete_groth16_input(inputs);
+    B::delete_groth16_params(params);
+}
+
 template <typename B>
 void run_prover(
         const char *params_path,
         const char *input_path,
         const char *output_path,
-        const char *preprocessed_path)
+        const char *preprocessed_path,
+        size_t memory_budget)
 {
     B::init_public_params();
 
@@ -128,6 +293,13 @@ void run_prover(
     static constexpr int C = 4;
     FILE *preprocessed_file = fopen(preprocessed_path, "r");
 
+    if (memory_budget != 0) {
+        run_prover_streamed<B>(params_file, input_path, output_path, preprocessed_file, memory_budget, d, orig_d, m);
+        fclose(preprocessed_file);
+        print_time(beginning, "Total runtime (incl. file reads)");
+        return;
+    }
+
     size_t space = ((m + 1) + R - 1) / R;
     size_t space_H = ((d) + R - 1) / R;
 
@@ -255,6 +427,58 @@ void run_prover(
     print_time(beginning, "Total runtime (incl. file reads)");
 }
 
+static std::vector<char> read_file(const char *path) {
+    std::vector<char> data;
+    FILE *f = fopen(path, "r");
+    if (f == nullptr)
+        return data;
+    int c;
+    while ((c = fgetc(f)) != EOF)
+        data.push_back(char(c));
+    fclose(f);
+    return data;
+}
+
+// Checks the streamed multiexps against the multiexps with all multiples loaded. The
+// proof is computed without a memory budget first, and then with budgets that give
+// chunks of a multiple of R points (the G2 query gets half the chunk size, so its chunks
+// are a multiple of its 2*R points) and with a budget that gives partial groups.
+// All proofs need to be the same.
+template <typename B>
+bool check_streamed(
+        const char *params_path,
+        const char *input_path,
+        const char *output_path,
+        const char *preprocessed_path)
+{
+    typedef typename ec_type<B>::ECp ECp;
+
+    static constexpr int R = 32;
+    static constexpr int C = 4;
+    static constexpr size_t num_multiples = (1U << C) - 1;
+    static constexpr size_t aff_G1_bytes = 2 * ECp::field_type::DEGREE * ELT_BYTES;
+    // The memory budget for chunks of a single G1 point (see multiexp_streamed)
+    static constexpr size_t point_budget = 2 * num_multiples * aff_G1_bytes;
+
+    run_prover<B>(params_path, input_path, output_path, preprocessed_path, 0);
+    std::vector<char> expected = read_file(output_path);
+    if (expected.empty()) {
+        fprintf(stderr, "!! No proof in \"%s\"\n", output_path);
+        return false;
+    }
+
+    std::string streamed_path = std::string(output_path) + ".streamed";
+    bool ok = true;
+    for (size_t chunk_size : { size_t(4 * R), size_t(8 * R), size_t(4 * R + 3) }) {
+        run_prover<B>(params_path, input_path, streamed_path.c_str(), preprocessed_path, chunk_size * point_budget);
+        bool same = (read_file(streamed_path.c_str()) == expected);
+        printf("Streamed with chunks of %zu points: %s\n", chunk_size, same ? "OK" : "MISMATCH");
+        ok = ok && same;
+    }
+    remove(streamed_path.c_str());
+    return ok;
+}
+
 int main(int argc, char **argv) {
   printf("main start\n");
   setbuf(stdout, NULL);
@@ -266,7 +490,15 @@ int main(int argc, char **argv) {
       const char *input_path = argv[3];
       const char *preprocess_path = argv[4];
       const char *output_path = argv[5];
-      run_prover<alt_bn128_libsnark>(params_path, input_path, output_path, preprocess_path);
+      // Optional memory budget (in MB) for the precomputed multiples, 0 == load everything
+      size_t memory_budget = (argc > 6) ? size_t(atoll(argv[6])) << 20 : 0;
+      run_prover<alt_bn128_libsnark>(params_path, input_path, output_path, preprocess_path, memory_budget);
+  } else if (mode == "check-streamed") {
+      const char *input_path = argv[3];
+      const char *preprocess_path = argv[4];
+      const char *output_path = argv[5];
+      if (!check_streamed<alt_bn128_libsnark>(params_path, input_path, output_path, preprocess_path))
+          return 1;
   } else if (mode == "preprocess") {
         const char *preprocess_path = argv[3];
         run_preprocess(params_path, preprocess_path);
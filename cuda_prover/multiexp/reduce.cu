@@ -21,8 +21,8 @@ ec_multiexp_straus(var *out, const var *multiples_, const var *scalars_, size_t
     size_t n = (N + RR - 1) / RR;
     if (idx < n) {
         // TODO: Treat remainder separately so R can remain a compile time constant
-        size_t R = (idx < n - 1) ? RR : (N % RR);
-        if (R == 0) R = 1;
+        // (the last group is only partial when RR doesn't divide N)
+        size_t R = (idx < n - 1 || N % RR == 0) ? RR : (N % RR);
 
         typedef typename EC::group_type Fr;
         static constexpr int JAC_POINT_LIMBS = 3 * EC::field_type::DEGREE * ELT_LIMBS;
@@ -134,10 +134,8 @@ static constexpr size_t threads_per_block = 256;
 
 template< typename EC, int C, int R >
 void
-ec_reduce_straus(cudaStream_t &strm, var *out, const var *multiples, const var *scalars, size_t N)
+ec_reduce_straus_on_stream(cudaStream_t strm, var *out, const var *multiples, const var *scalars, size_t N)
 {
-    cudaStreamCreate(&strm);
-
     static constexpr size_t pt_limbs = EC::NELTS * ELT_LIMBS;
     size_t n = (N + R - 1) / R;
 
@@ -155,6 +153,14 @@ ec_reduce_straus(cudaStream_t &strm, var *out, const var *multiples, const var *
     }
 }
 
+template< typename EC, int C, int R >
+void
+ec_reduce_straus(cudaStream_t &strm, var *out, const var *multiples, const var *scalars, size_t N)
+{
+    cudaStreamCreate(&strm);
+    ec_reduce_straus_on_stream<EC, C, R>(strm, out, multiples, scalars, N);
+}
+
 template< typename EC >
 void
 ec_reduce(cudaStream_t &strm, var *X, const var *w, size_t n)
@@ -273,3 +279,26 @@ load_points_affine(size_t n, FILE *inputs)
     }
     return mem;
 }
+
+// Reads the multiples of the points [start, start + n) of a query with N points
+// starting at 'offset' in the preprocessed file. The multiples are stored per window
+// (see ec_multiexp_straus), so every window is read separately.
+template< typename EC, int C >
+void
+load_points_affine_chunk(FILE *inputs, off_t offset, size_t N, size_t start, size_t n, char *out)
+{
+    typedef typename EC::field_type FF;
+
+    static constexpr size_t coord_bytes = FF::DEGREE * ELT_BYTES;
+    static constexpr size_t aff_pt_bytes = 2 * coord_bytes;
+    static constexpr size_t num_multiples = (1U << C) - 1;
+
+    for (size_t w = 0; w < num_multiples; ++w) {
+        off_t pos = offset + off_t((w * N + start) * aff_pt_bytes);
+        if (fseeko(inputs, pos, SEEK_SET) != 0 ||
+            fread(out + w * n * aff_pt_bytes, aff_pt_bytes, n, inputs) != n) {
+            fprintf(stderr, "Failed to read curve points\n");
+            abort();
+        }
+    }
+}
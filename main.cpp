@@ -6,15 +6,31 @@
 #include "Circuits/OnchainWithdrawalCircuit.h"
 #include "Circuits/OffchainWithdrawalCircuit.h"
 #include "Circuits/InternalTransferCircuit.h"
+#include "Utils/JobQueue.h"
+#include "Utils/CircuitCache.h"
+#include "Utils/Compression.h"
+#include "Utils/Metrics.h"
+#include "Utils/ProofCache.h"
+#include "Utils/LocalChannel.h"
+#include "Utils/Checkpoint.h"
+#include "Utils/ProvingKeyIO.h"
+#include "Utils/HugePages.h"
+#include "Utils/BlockIO.h"
+#include "Utils/BlockJson.h"
 
 #include "ThirdParty/httplib.h"
 //#include "ThirdParty/json.hpp"
 #include "ethsnarks.hpp"
 #include "import.hpp"
 #include "stubs.hpp"
+#include <libff/common/profiling.hpp>
 #include <fstream>
 #include <chrono>
 #include <mutex>
+#include <thread>
+#include <future>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #ifdef MULTICORE
 #include <omp.h>
@@ -88,6 +104,16 @@ void printMemoryUsage()
 void printMemoryUsage() {}
 #endif
 
+// Returns the resident set size of the process (in bytes)
+size_t getResidentMemory()
+{
+    std::ifstream statm("/proc/self/statm");
+    size_t pages = 0;
+    size_t residentPages = 0;
+    statm >> pages >> residentPages;
+    return residentPages * size_t(sysconf(_SC_PAGESIZE));
+}
+
 using json = nlohmann::json;
 
 enum class Mode
@@ -156,6 +182,7 @@ struct BenchmarkConfig
     std::vector<unsigned int> multi_exp_prefetch_locality;   // 4 == no prefetching, [0, 3] prefetch locality
     std::vector<unsigned int> prefetch_stride;               // 4 * L1_CACHE_BYTES
     std::vector<unsigned int> multi_exp_look_ahead;
+    std::vector<bool> huge_pages;                            // Prover buffers backed by huge pages (optional)
 };
 
 static void from_json(const nlohmann::json& j, BenchmarkConfig& config)
@@ -170,6 +197,67 @@ static void from_json(const nlohmann::json& j, BenchmarkConfig& config)
     config.multi_exp_prefetch_locality = j.at("multi_exp_prefetch_locality").get<std::vector<unsigned int>>();
     config.prefetch_stride = j.at("prefetch_stride").get<std::vector<unsigned int>>();
     config.multi_exp_look_ahead = j.at("multi_exp_look_ahead").get<std::vector<unsigned int>>();
+    if (j.contains("huge_pages"))
+    {
+        config.huge_pages = j.at("huge_pages").get<std::vector<bool>>();
+    }
+    else
+    {
+        config.huge_pages = {Loopring::hugePagesEnabled()};
+    }
+}
+
+struct ServerConfig
+{
+    unsigned int max_queued_jobs = 16;
+    unsigned int max_finished_jobs = 1000;
+    std::string jobs_directory = "jobs";
+    unsigned int memory_budget_mb = 0;  // 0 == no limit
+    std::string proof_cache_directory = "proof_cache";
+    unsigned int proof_cache_max_entries = 1000; // 0 == no proof cache
+    bool checkpoint_witness = true;              // Store the witness of a job so it can be resumed after a restart
+    std::string socket_path;                     // Unix domain socket for local operators (empty == disabled)
+    unsigned int ring_size_mb = 64;              // Size of each shared memory ring of a local connection
+};
+
+static void from_json(const nlohmann::json& j, ServerConfig& config)
+{
+    if (j.contains("max_queued_jobs"))
+    {
+        config.max_queued_jobs = j.at("max_queued_jobs").get<unsigned int>();
+    }
+    if (j.contains("max_finished_jobs"))
+    {
+        config.max_finished_jobs = j.at("max_finished_jobs").get<unsigned int>();
+    }
+    if (j.contains("jobs_directory"))
+    {
+        config.jobs_directory = j.at("jobs_directory").get<std::string>();
+    }
+    if (j.contains("memory_budget_mb"))
+    {
+        config.memory_budget_mb = j.at("memory_budget_mb").get<unsigned int>();
+    }
+    if (j.contains("proof_cache_directory"))
+    {
+        config.proof_cache_directory = j.at("proof_cache_directory").get<std::string>();
+    }
+    if (j.contains("proof_cache_max_entries"))
+    {
+        config.proof_cache_max_entries = j.at("proof_cache_max_entries").get<unsigned int>();
+    }
+    if (j.contains("checkpoint_witness"))
+    {
+        config.checkpoint_witness = j.at("checkpoint_witness").get<bool>();
+    }
+    if (j.contains("socket_path"))
+    {
+        config.socket_path = j.at("socket_path").get<std::string>();
+    }
+    if (j.contains("ring_size_mb"))
+    {
+        config.ring_size_mb = j.at("ring_size_mb").get<unsigned int>();
+    }
 }
 
 static inline auto now() -> decltype(std::chrono::high_resolution_clock::now()) {
@@ -190,20 +278,147 @@ void print_time(const T& t1, const char* str)
     printf("%s (%dms)\n", str, elapsed_time_ms(t1));
 }
 
+/**
+* Durations of the startup phases. Some phases run concurrently, so the total time is
+* reported next to the time it would take to run them one after another.
+*/
+class StartupReport
+{
+public:
+    StartupReport() :
+        begin(now())
+    {
+
+    }
+
+    void add(const std::string& phase, unsigned int duration_ms)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        phases.push_back(std::make_pair(phase, duration_ms));
+    }
+
+    void print() const
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        unsigned int sequential_ms = 0;
+        std::cout << "Startup:" << std::endl;
+        for (const auto& phase : phases)
+        {
+            std::cout << "- " << phase.first << ": " << phase.second << "ms" << std::endl;
+            sequential_ms += phase.second;
+        }
+        std::cout << "Startup took " << elapsed_time_ms(begin) << "ms (" << sequential_ms << "ms when run one after another)" << std::endl;
+    }
+
+private:
+    decltype(now()) begin;
+    std::vector<std::pair<std::string, unsigned int>> phases;
+    mutable std::mutex mtx;
+};
+
+std::string getBaseName(Loopring::BlockType blockType)
+{
+    switch(blockType)
+    {
+        case Loopring::BlockType::RingSettlement: return "trade";
+        case Loopring::BlockType::Deposit: return "deposit";
+        case Loopring::BlockType::OnchainWithdrawal: return "withdraw_onchain";
+        case Loopring::BlockType::OffchainWithdrawal: return "withdraw_offchain";
+        case Loopring::BlockType::InternalTransfer: return "internal_transfer";
+        default: return "unknown";
+    }
+}
+
+// Records the duration of a prover phase (per circuit)
+void observePhaseDuration(double seconds, const std::string& phase, Loopring::Circuit* circuit)
+{
+    Loopring::MetricLabels labels = {{"phase", phase}};
+    if (circuit != nullptr)
+    {
+        labels.push_back({"block_type", getBaseName(circuit->getBlockType())});
+        labels.push_back({"block_size", std::to_string(circuit->getBlockSize())});
+    }
+    Loopring::Metrics::getInstance().observe("prover_phase_duration_seconds", labels, seconds);
+}
+
+template<typename T>
+void observePhase(const T& begin, const char* phase, Loopring::Circuit* circuit)
+{
+    observePhaseDuration(elapsed_time_ms(begin) / 1000.0, phase, circuit);
+}
+
+// Records the time spent in the profiling blocks of libsnark (e.g. the FFTs and the multi-exponentiations)
+// since 'profile' was copied from libff::cumulative_times, as phases "prove: <block>"
+void observeProverPhases(const std::map<std::string, long long>& profile, Loopring::Circuit* circuit)
+{
+    for (const auto& block : libff::cumulative_times)
+    {
+        auto it = profile.find(block.first);
+        long long elapsed_ns = block.second - ((it != profile.end()) ? it->second : 0);
+        if (elapsed_ns > 0)
+        {
+            observePhaseDuration(elapsed_ns / 1e9, "prove: " + block.first, circuit);
+        }
+    }
+}
+
 bool fileExists(const std::string& fileName)
 {
     std::ifstream infile(fileName.c_str());
     return infile.good();
 }
 
+size_t getFileSize(const std::string& fileName)
+{
+    struct stat st;
+    if (stat(fileName.c_str(), &st) != 0)
+    {
+        return 0;
+    }
+    return size_t(st.st_size);
+}
+
+// The buffers are advised to use huge pages before they are touched (when they are allocated here)
 void initProverContextBuffers(ProverContextT& context)
 {
-    context.scratch_exponents.resize(std::max(context.constraint_system->num_variables() + 1, context.domain->m - 1));
+    size_t numExponents = std::max(context.constraint_system->num_variables() + 1, context.domain->m - 1);
+    Loopring::reserveHugePages(context.scratch_exponents, numExponents);
+    Loopring::reserveHugePages(context.aA, context.domain->m+1);
+    Loopring::reserveHugePages(context.aB, context.domain->m+1);
+    Loopring::reserveHugePages(context.aH, context.domain->m+1);
+    context.scratch_exponents.resize(numExponents);
     context.aA.resize(context.domain->m+1, FieldT::one());
     context.aB.resize(context.domain->m+1, FieldT::one());
     context.aH.resize(context.domain->m+1, FieldT::one());
 }
 
+// Frees the buffers so they are allocated again by initProverContextBuffers
+void releaseProverContextBuffers(ProverContextT& context)
+{
+    decltype(context.scratch_exponents)().swap(context.scratch_exponents);
+    decltype(context.aA)().swap(context.aA);
+    decltype(context.aB)().swap(context.aB);
+    decltype(context.aH)().swap(context.aH);
+}
+
+// For a proving key that was already filled in, khugepaged collapses the pages in the background
+void adviseProvingKeyHugePages(const ethsnarks::ProvingKeyT& proving_key)
+{
+    Loopring::adviseHugePages(proving_key.A_query);
+    Loopring::adviseHugePages(proving_key.B_query);
+    Loopring::adviseHugePages(proving_key.H_query);
+    Loopring::adviseHugePages(proving_key.L_query);
+}
+
+bool keyPairExists(const std::string& baseFilename)
+{
+    return fileExists(baseFilename + "_pk.raw") && fileExists(baseFilename + "_vk.json")
+#ifdef GPU_PROVE
+        && fileExists(baseFilename + "_params.raw")
+#endif
+    ;
+}
+
 bool generateKeyPair(ethsnarks::ProtoboardT& pb, std::string& baseFilename)
 {
     std::string provingKeyFilename = baseFilename + "_pk.raw";
@@ -211,11 +426,7 @@ bool generateKeyPair(ethsnarks::ProtoboardT& pb, std::string& baseFilename)
 #ifdef GPU_PROVE
     std::string paramsFilename = baseFilename + "_params.raw";
 #endif
-    if (fileExists(provingKeyFilename.c_str()) && fileExists(verificationKeyFilename.c_str())
-#ifdef GPU_PROVE
-        && fileExists(paramsFilename.c_str())
-#endif
-    )
+    if (keyPairExists(baseFilename))
     {
         return true;
     }
@@ -249,8 +460,41 @@ libsnark::Config loadConfig(const std::string& filename)
     return loadJSON(filename).get<libsnark::Config>();
 }
 
+// The proving key is available in the raw, native or compressed format
+bool provingKeyExists(const std::string& pk_file)
+{
+    return fileExists(pk_file) || fileExists(Loopring::getNativeProvingKeyFilename(pk_file)) ||
+        fileExists(Loopring::getCompressedProvingKeyFilename(pk_file));
+}
+
 void loadProvingKey(const std::string& pk_file, ethsnarks::ProvingKeyT& proving_key)
 {
+    // Use the native pk when it was created from this pk
+    std::string nativeFilename = Loopring::getNativeProvingKeyFilename(pk_file);
+    if (Loopring::isNativeProvingKeyValid(nativeFilename, pk_file))
+    {
+        std::cout << "Loading native proving key " << nativeFilename << "..." << std::endl;
+        auto begin = now();
+        if (Loopring::loadNativeProvingKey(nativeFilename, proving_key))
+        {
+            print_time(begin, "Proving key loaded");
+            return;
+        }
+    }
+
+    // Only the compressed pk may be installed to save disk space
+    std::string compressedFilename = Loopring::getCompressedProvingKeyFilename(pk_file);
+    if (!fileExists(pk_file) && fileExists(compressedFilename))
+    {
+        std::cout << "Loading compressed proving key " << compressedFilename << "..." << std::endl;
+        auto begin = now();
+        if (Loopring::loadCompressedProvingKey(compressedFilename, proving_key))
+        {
+            print_time(begin, "Proving key loaded");
+            return;
+        }
+    }
+
     std::cout << "Loading proving key " << pk_file << "..." << std::endl;
     auto begin = now();
     auto pk = ethsnarks::load_proving_key(pk_file.c_str());
@@ -263,29 +507,53 @@ void loadProvingKey(const std::string& pk_file, ethsnarks::ProvingKeyT& proving_
     proving_key.B_query = std::move(pk.B_query);
     proving_key.H_query = std::move(pk.H_query);
     proving_key.L_query = std::move(pk.L_query);
+    adviseProvingKeyHugePages(proving_key);
     print_time(begin, "Proving key loaded");
 }
 
+ServerConfig loadServerConfig(const std::string& filename)
+{
+    json config = loadJSON(filename);
+    if (!config.contains("server"))
+    {
+        return ServerConfig();
+    }
+    return config.at("server").get<ServerConfig>();
+}
+
 VerificationKeyT loadVerificationKey(const std::string& vk_file)
 {
     std::cout << "Loading verification key " << vk_file << "..." << std::endl;
     return vk_from_json(loadJSON(vk_file));
 }
 
-std::string proveCircuit(ProverContextT& context, Loopring::Circuit* circuit)
+// Proves the witness values in 'witness', which needs to be a witness for the circuit
+std::string proveCircuit(ProverContextT& context, Loopring::Circuit* circuit, const ethsnarks::ProtoboardT& witness)
 {
     std::cout << "Generating proof..." << std::endl;
     auto begin = now();
-    std::string jProof = ethsnarks::prove(context, circuit->getPb());
+    std::map<std::string, long long> profile = libff::cumulative_times;
+    std::string jProof = ethsnarks::prove(context, witness);
+    observePhase(begin, "prove", circuit);
+    observeProverPhases(profile, circuit);
     unsigned int elapsed_ms = elapsed_time_ms(begin);
     elapsed_ms = elapsed_ms == 0 ? 1 : elapsed_ms;
     std::cout << "Proof generated in " << float(elapsed_ms) / 1000.0f << " seconds ("
         << (circuit->getPb().num_constraints() * 10) / (elapsed_ms / 100) << " constraints/second)" << std::endl;
+    Loopring::Metrics::getInstance().set("prover_constraints_per_second",
+        {{"block_type", getBaseName(circuit->getBlockType())}, {"block_size", std::to_string(circuit->getBlockSize())}},
+        (circuit->getPb().num_constraints() * 1000.0) / elapsed_ms);
     return jProof;
 }
 
+std::string proveCircuit(ProverContextT& context, Loopring::Circuit* circuit)
+{
+    return proveCircuit(context, circuit, circuit->getPb());
+}
+
 bool writeProof(const std::string& jProof, const std::string& proofFilename)
 {
+    auto begin = now();
     std::ofstream fproof(proofFilename);
     if (!fproof.is_open())
     {
@@ -294,6 +562,7 @@ bool writeProof(const std::string& jProof, const std::string& proofFilename)
     }
     fproof << jProof;
     fproof.close();
+    observePhase(begin, "write", nullptr);
     std::cout << "Proof written to: " << proofFilename << std::endl;
     return true;
 }
@@ -320,13 +589,19 @@ Loopring::Circuit* createCircuit(Loopring::BlockType blockType, unsigned int blo
     std::cout << "Creating circuit... " << std::endl;
     auto begin = now();
     Loopring::Circuit* circuit = newCircuit(blockType, outPb);
+    if (circuit == nullptr)
+    {
+        return nullptr;
+    }
     circuit->generateConstraints(onchainDataAvailability, blockSize);
     circuit->printInfo();
     print_time(begin, "Circuit created");
     return circuit;
 }
 
-bool generateWitness(Loopring::Circuit* circuit, const json& input)
+// 'input' is either the JSON block or a binary block
+template<typename InputT>
+bool generateWitness(Loopring::Circuit* circuit, const InputT& input)
 {
     std::cout << "Generating witness... " << std::endl;
     auto begin = now();
@@ -335,10 +610,62 @@ bool generateWitness(Loopring::Circuit* circuit, const json& input)
         std::cerr << "Could not generate witness!" << std::endl;
         return false;
     }
+    observePhase(begin, "witness", circuit);
     print_time(begin, "Witness generated");
     return true;
 }
 
+// Opens a block file, binary blocks are recognized by their header
+std::unique_ptr<Loopring::BlockFile> openBlockFile(const std::string& filename)
+{
+    if (Loopring::isBinaryBlock(filename))
+    {
+        std::unique_ptr<Loopring::BinaryBlock> block(new Loopring::BinaryBlock());
+        if (!block->open(filename))
+        {
+            return nullptr;
+        }
+        return std::move(block);
+    }
+    std::unique_ptr<Loopring::JsonBlock> block(new Loopring::JsonBlock());
+    if (!block->open(filename))
+    {
+        return nullptr;
+    }
+    return std::move(block);
+}
+
+Loopring::CircuitKey getCircuitKey(const Loopring::BlockFile& blockFile)
+{
+    return Loopring::CircuitKey(blockFile.getBlockType(), blockFile.getBlockSize(), blockFile.getOnchainDataAvailability());
+}
+
+template<typename BlockT>
+bool convertBlockToBinary(const Loopring::BlockFile& input, const std::string& filename)
+{
+    BlockT block;
+    return input.read(block) &&
+        Loopring::writeBinaryBlock(filename, input.getBlockType(), input.getBlockSize(), input.getOnchainDataAvailability(), block);
+}
+
+// Converts a block to the binary block format
+bool convertBlockToBinary(const Loopring::BlockFile& input, const std::string& filename)
+{
+    switch(input.getBlockType())
+    {
+        case Loopring::BlockType::RingSettlement: return convertBlockToBinary<Loopring::RingSettlementBlock>(input, filename);
+        case Loopring::BlockType::Deposit: return convertBlockToBinary<Loopring::DepositBlock>(input, filename);
+        case Loopring::BlockType::OnchainWithdrawal: return convertBlockToBinary<Loopring::OnchainWithdrawalBlock>(input, filename);
+        case Loopring::BlockType::OffchainWithdrawal: return convertBlockToBinary<Loopring::OffchainWithdrawalBlock>(input, filename);
+        case Loopring::BlockType::InternalTransfer: return convertBlockToBinary<Loopring::InternalTransferBlock>(input, filename);
+        default:
+        {
+            std::cerr << "Cannot convert block of unknown block type: " << int(input.getBlockType()) << std::endl;
+            return false;
+        }
+    }
+}
+
 bool validateCircuit(Loopring::Circuit* circuit)
 {
     std::cout << "Validating block..."<< std::endl;
@@ -349,177 +676,727 @@ bool validateCircuit(Loopring::Circuit* circuit)
         std::cerr << "Block is not valid!" << std::endl;
         return false;
     }
+    observePhase(begin, "validate", circuit);
     print_time(begin, "Block is valid");
     return true;
 }
 
-std::string getBaseName(Loopring::BlockType blockType)
+std::string getCircuitName(const Loopring::CircuitKey& key)
 {
-    switch(blockType)
+    std::string strOnchainDataAvailability = key.onchainDataAvailability ? "_DA_" : "_";
+    std::string postFix = strOnchainDataAvailability + std::to_string(key.blockSize);
+    return getBaseName(key.blockType) + postFix;
+}
+
+std::string getBaseFilename(const Loopring::CircuitKey& key)
+{
+    return "keys/" + getCircuitName(key);
+}
+
+std::string getProvingKeyFilename(const std::string& baseFilename)
+{
+    return baseFilename + "_pk.raw";
+}
+
+// Identifies the proving key of the circuit by the hash of its verification key
+// (which changes together with the proving key). Empty if the key cannot be read.
+std::string getProvingKeyID(const Loopring::CircuitKey& key)
+{
+    std::ifstream file(getBaseFilename(key) + "_vk.json");
+    if (!file.is_open())
     {
-        case Loopring::BlockType::RingSettlement: return "trade";
-        case Loopring::BlockType::Deposit: return "deposit";
-        case Loopring::BlockType::OnchainWithdrawal: return "withdraw_onchain";
-        case Loopring::BlockType::OffchainWithdrawal: return "withdraw_offchain";
-        case Loopring::BlockType::InternalTransfer: return "internal_transfer";
-        default: return "unknown";
+        return "";
+    }
+    std::stringstream ss;
+    ss << file.rdbuf();
+    return getCircuitName(key) + ":" + Loopring::sha256(ss.str());
+}
+
+// The constants are shared by all circuits in the process, so they are left alone
+// when other circuits are in use (server mode)
+void optimizeCircuit(ethsnarks::ProtoboardT& pb, const libsnark::Config& config, bool shrinkConstants = true)
+{
+    if (config.swapAB)
+    {
+        pb.constraint_system.swap_AB_if_beneficial();
+    }
+    pb.constraint_system.constraints.shrink_to_fit();
+    pb.values.shrink_to_fit();
+    if (shrinkConstants)
+    {
+        libsnark::ConstantStorage<FieldT>::getInstance().constants.shrink_to_fit();
+    }
+}
+
+// Generates the keys of a circuit when they don't exist yet. The circuit is freed afterwards.
+bool createKeys(const Loopring::CircuitKey& key, const libsnark::Config& config)
+{
+    std::string baseFilename = getBaseFilename(key);
+    if (keyPairExists(baseFilename))
+    {
+        std::cout << "Keys already exist: " << baseFilename << std::endl;
+        return true;
+    }
+    std::cout << "Creating keys for " << key.toString() << "..." << std::endl;
+
+    auto begin = now();
+    ethsnarks::ProtoboardT pb;
+    std::unique_ptr<Loopring::Circuit> circuit(createCircuit(key.blockType, key.blockSize, key.onchainDataAvailability, pb));
+    if (!circuit)
+    {
+        return false;
+    }
+    optimizeCircuit(pb, config);
+    print_time(begin, "Circuit constructed");
+
+    begin = now();
+    if (!generateKeyPair(pb, baseFilename))
+    {
+        std::cerr << "Failed to generate keys!" << std::endl;
+        return false;
+    }
+    print_time(begin, "Keys generated");
+    return true;
+}
+
+// Constructs the circuit and sets up its prover context and witness buffer
+bool buildCircuitInstance(Loopring::CircuitInstance& instance, const libsnark::Config& config)
+{
+    std::string provingKeyFilename = getProvingKeyFilename(getBaseFilename(instance.key));
+    if (!provingKeyExists(provingKeyFilename))
+    {
+        std::cerr << "Failed to find pk: " << provingKeyFilename << std::endl;
+        return false;
+    }
+
+    size_t memoryBefore = getResidentMemory();
+    StartupReport startup;
+
+    // The proving key is loaded while the circuit is constructed
+    ethsnarks::ProvingKeyT& provingKey = instance.context.provingKey;
+    std::future<void> provingKeyLoaded = std::async(std::launch::async, [&]() {
+        auto begin = now();
+        loadProvingKey(provingKeyFilename, provingKey);
+        startup.add("load proving key", elapsed_time_ms(begin));
+    });
+
+    auto begin = now();
+    const Loopring::CircuitKey& key = instance.key;
+    instance.circuit.reset(createCircuit(key.blockType, key.blockSize, key.onchainDataAvailability, instance.pb));
+    if (!instance.circuit)
+    {
+        // Don't leave a half loaded proving key behind
+        provingKeyLoaded.wait();
+        instance.context.provingKey = ethsnarks::ProvingKeyT();
+        instance.pb.constraint_system.constraints.clear();
+        instance.pb.values.clear();
+        return false;
+    }
+    optimizeCircuit(instance.pb, config, false);
+    startup.add("construct circuit", elapsed_time_ms(begin));
+    provingKeyLoaded.get();
+
+    begin = now();
+    ProverContextT& context = instance.context;
+    context.constraint_system = &(instance.pb.constraint_system);
+    context.config = config;
+    context.domain = get_domain(instance.pb, context.provingKey, config);
+    initProverContextBuffers(context);
+    instance.initWitnessBuffer();
+    startup.add("setup prover context", elapsed_time_ms(begin));
+    startup.print();
+    Loopring::printHugePageUsage();
+
+    // Freed memory from unloaded circuits can be reused, so never estimate less than the pk size
+    size_t memoryAfter = getResidentMemory();
+    size_t memoryUsed = (memoryAfter > memoryBefore) ? memoryAfter - memoryBefore : 0;
+    instance.memoryUsage = std::max(memoryUsed, getFileSize(provingKeyFilename));
+    return true;
+}
+
+void registerMetrics()
+{
+    using namespace Loopring;
+    std::vector<double> buckets = {0.01, 0.1, 0.5, 1, 2, 5, 10, 30, 60, 120, 300, 600, 1200, 3600};
+    Metrics& metrics = Metrics::getInstance();
+    metrics.describe("prover_phase_duration_seconds", MetricType::Histogram, "Duration of each phase of proving a block", buckets);
+    metrics.describe("prover_constraints_per_second", MetricType::Gauge, "Proving speed of the last proof");
+    metrics.describe("prover_jobs_total", MetricType::Counter, "Finished jobs");
+    metrics.describe("prover_failures_total", MetricType::Counter, "Failed jobs by reason");
+    metrics.describe("prover_proof_cache_total", MetricType::Counter, "Proof cache lookups by result");
+    metrics.describe("prover_proof_cache_entries", MetricType::Gauge, "Proofs in the proof cache");
+    metrics.describe("prover_queue_depth", MetricType::Gauge, "Jobs waiting in the queue");
+    metrics.describe("prover_jobs_active", MetricType::Gauge, "Jobs currently being worked on");
+    metrics.describe("prover_jobs_at_risk", MetricType::Gauge, "Jobs expected to miss their deadline");
+    metrics.describe("prover_memory_resident_bytes", MetricType::Gauge, "Resident set size");
+    metrics.describe("prover_memory_peak_bytes", MetricType::Gauge, "Peak resident set size");
+    metrics.describe("prover_memory_huge_pages_bytes", MetricType::Gauge, "Memory backed by transparent huge pages");
+}
+
+void setJobError(std::string& error, const char* reason, const std::string& message)
+{
+    error = message;
+    Loopring::Metrics::getInstance().increment("prover_failures_total", {{"reason", reason}});
+}
+
+// Reads the witness of a job from its checkpoint into the witness buffer of the circuit
+std::shared_ptr<Loopring::CircuitInstance> resumeJobWitness(Loopring::CircuitCache& circuitCache, const Loopring::Job& job)
+{
+    auto begin = now();
+    Loopring::CircuitKey key;
+    if (!Loopring::readWitnessCheckpointKey(job.checkpoint, key) || !circuitCache.isHosted(key))
+    {
+        return nullptr;
+    }
+    std::shared_ptr<Loopring::CircuitInstance> instance = circuitCache.acquire(key);
+    if (!instance)
+    {
+        return nullptr;
+    }
+    if (!Loopring::readWitnessCheckpoint(job.checkpoint, key, instance->acquireWitness()))
+    {
+        instance->releaseWitness();
+        return nullptr;
+    }
+    observePhase(begin, "resume", instance->circuit.get());
+    std::cout << "Resumed " << job.getDescription() << " from checkpoint " << job.checkpoint << std::endl;
+    return instance;
+}
+
+// Looks up the proof of the block in the cache. Also sets the proof cache key of the job.
+// A block that doesn't need to be validated can also use the proof of a validated block.
+bool findCachedProof(Loopring::ProofCache& proofCache, Loopring::Job& job, const Loopring::CircuitKey& key,
+                     const std::string& blockHash, std::string& proof)
+{
+    if (!proofCache.isEnabled())
+    {
+        return false;
+    }
+    std::string provingKeyID = getProvingKeyID(key);
+    if (provingKeyID.length() == 0)
+    {
+        return false;
+    }
+    job.inputHash = Loopring::ProofCache::getKey(blockHash, provingKeyID, job.validate);
+    bool found = proofCache.get(job.inputHash, proof) ||
+        (!job.validate && proofCache.get(Loopring::ProofCache::getKey(blockHash, provingKeyID, true), proof));
+    Loopring::Metrics::getInstance().increment("prover_proof_cache_total", {{"result", found ? "hit" : "miss"}});
+    if (found && job.proofFilename.length() != 0 && !writeProof(proof, job.proofFilename))
+    {
+        return false;
+    }
+    return found;
+}
+
+// Generates the witness for the job. On success the witness is stored in the witness buffer
+// of the returned circuit instance, ready to be proven.
+// Blocks read from a file are looked up in the proof cache first, when the block was
+// already proven 'cachedProof' is set instead (and nullptr is returned without an error).
+std::shared_ptr<Loopring::CircuitInstance> generateJobWitness(Loopring::CircuitCache& circuitCache, Loopring::ProofCache& proofCache,
+                                                              Loopring::Job& job, std::string& error, std::string& cachedProof)
+{
+    // Jobs interrupted after their witness was generated continue from there
+    if (job.checkpoint.length() != 0)
+    {
+        std::shared_ptr<Loopring::CircuitInstance> instance = resumeJobWitness(circuitCache, job);
+        if (instance)
+        {
+            return instance;
+        }
+        if (!job.block && !job.input && job.blockFilename.length() == 0)
+        {
+            setJobError(error, "load", "Block was sent in the request and its checkpoint could not be used!");
+            return nullptr;
+        }
+    }
+
+    // The block is either sent in the request or needs to be read from disk
+    std::shared_ptr<const Loopring::BlockFile> blockFile = job.block;
+    bool readFromFile = !job.block && !job.input;
+    if (readFromFile)
+    {
+        auto begin = now();
+        blockFile = openBlockFile(job.blockFilename);
+        if (blockFile && proofCache.isEnabled())
+        {
+            // The block is hashed in its parsed form, keep it so the file is only parsed once
+            std::shared_ptr<Loopring::ParsedBlock> parsedBlock = std::make_shared<Loopring::ParsedBlock>();
+            blockFile = parsedBlock->load(*blockFile) ? parsedBlock : nullptr;
+        }
+        if (!blockFile)
+        {
+            setJobError(error, "load", "Failed to load block!");
+            return nullptr;
+        }
+        observePhase(begin, "parse", nullptr);
+    }
+
+    // Find the circuit for this block
+    Loopring::CircuitKey key = blockFile ? getCircuitKey(*blockFile) : job.input->get<Loopring::CircuitKey>();
+    if (readFromFile && proofCache.isEnabled() && findCachedProof(proofCache, job, key, blockFile->getHash(), cachedProof))
+    {
+        return nullptr;
+    }
+    if (!circuitCache.isHosted(key))
+    {
+        setJobError(error, "incompatible", "Incompatible block requested! Use /info to check which blocks can be proven.");
+        return nullptr;
+    }
+    std::shared_ptr<Loopring::CircuitInstance> instance = circuitCache.acquire(key);
+    if (!instance)
+    {
+        setJobError(error, "construct", "Failed to construct circuit for block!");
+        return nullptr;
+    }
+
+    // No circuit can be constructed while the witness is generated
+    Loopring::ConstructionLock::Shared noConstruction(circuitCache.getConstructionLock());
+    bool witnessGenerated = blockFile ? generateWitness(instance->circuit.get(), *blockFile) :
+                                        generateWitness(instance->circuit.get(), *job.input);
+    if (!witnessGenerated)
+    {
+        setJobError(error, "witness", "Failed to generate witness for block!");
+        return nullptr;
+    }
+    if (job.validate)
+    {
+        if (!validateCircuit(instance->circuit.get()))
+        {
+            setJobError(error, "invalid", "Block is invalid!");
+            return nullptr;
+        }
+    }
+    instance->storeWitness();
+    return instance;
+}
+
+// 'checkpointWritten' is set while the witness is being written to its checkpoint,
+// the witness buffer is only released once that is done.
+// No circuit can be constructed while the block is being proven.
+std::string proveJob(Loopring::CircuitCache& circuitCache, Loopring::CircuitInstance& instance, const Loopring::Job& job,
+                     std::future<void>& checkpointWritten, std::string& error)
+{
+    std::string jProof;
+    {
+        Loopring::ConstructionLock::Shared noConstruction(circuitCache.getConstructionLock());
+        jProof = proveCircuit(instance.context, instance.circuit.get(), instance.getWitness());
+    }
+    if (checkpointWritten.valid())
+    {
+        checkpointWritten.wait();
+    }
+    instance.releaseWitness();
+    if (jProof.length() == 0)
+    {
+        setJobError(error, "prove", "Failed to prove block!");
+        return "";
+    }
+    if (job.proofFilename.length() != 0)
+    {
+        if(!writeProof(jProof, job.proofFilename))
+        {
+            setJobError(error, "write", "Failed to write proof!");
+            return "";
+        }
     }
+    return jProof;
 }
 
-std::string getProvingKeyFilename(const std::string& baseFilename)
-{
-    return baseFilename + "_pk.raw";
-}
-
-void runServer(Loopring::Circuit* circuit, const std::string& provingKeyFilename, const libsnark::Config& config, unsigned int port)
+void runServer(const std::vector<Loopring::CircuitKey>& circuits, const std::vector<Loopring::CircuitKey>& preload,
+               const libsnark::Config& config, const ServerConfig& serverConfig, unsigned int port)
 {
     using namespace httplib;
+    registerMetrics();
 
-    struct ProverStatus
+    // Circuits are constructed on first use (except the ones that need to be preloaded)
+    Loopring::CircuitCache circuitCache(circuits, size_t(serverConfig.memory_budget_mb) * 1024 * 1024,
+        [&](Loopring::CircuitInstance& instance) { return buildCircuitInstance(instance, config); });
+    for (const Loopring::CircuitKey& key : preload)
     {
-        bool proving = false;
-        std::string blockFilename;
-        std::string proofFilename;
-    };
+        circuitCache.acquire(key);
+    }
+
+    // Jobs waiting to be proven (and the results of finished jobs)
+    Loopring::JobQueue jobQueue(serverConfig.max_queued_jobs, serverConfig.max_finished_jobs, serverConfig.jobs_directory);
 
-    struct ProverStatusRAII
+    // Blocks with a generated witness, waiting to be proven
+    struct ProveTask
     {
-        ProverStatus& proverStatus;
-        ProverStatusRAII(ProverStatus& _proverStatus, const std::string& blockFilename, const std::string& proofFilename) : proverStatus(_proverStatus)
+        Loopring::Job job;
+        std::shared_ptr<Loopring::CircuitInstance> instance;
+        decltype(now()) begin;
+    };
+    Loopring::BoundedQueue<ProveTask> proveQueue(1);
+
+    // Proofs of blocks that were already proven
+    Loopring::ProofCache proofCache(serverConfig.proof_cache_directory, serverConfig.proof_cache_max_entries);
+
+    // Checkpoints are stored next to the job records
+    bool checkpointWitness = serverConfig.checkpoint_witness && serverConfig.jobs_directory.length() != 0;
+
+    // The witness of the next block is generated while the current block is being proven
+    std::thread witnessGenerator([&]() {
+        ProveTask task;
+        while (jobQueue.pop(task.job))
+        {
+            task.begin = now();
+            std::string error;
+            std::string cachedProof;
+            try
+            {
+                task.instance = generateJobWitness(circuitCache, proofCache, task.job, error, cachedProof);
+            }
+            catch (const std::exception& e)
+            {
+                task.instance = nullptr;
+                setJobError(error, "parse", std::string("Invalid block: ") + e.what());
+            }
+            if (cachedProof.length() != 0)
+            {
+                std::cout << "Returning cached proof for " << task.job.getDescription() << std::endl;
+                Loopring::Metrics::getInstance().increment("prover_jobs_total", {{"result", "done"}});
+                jobQueue.finish(task.job.id, cachedProof, "");
+                continue;
+            }
+            if (!task.instance)
+            {
+                std::cerr << "Job " << task.job.id << " failed: " << error << std::endl;
+                Loopring::Metrics::getInstance().increment("prover_jobs_total", {{"result", "failed"}});
+                jobQueue.finish(task.job.id, "", error);
+                continue;
+            }
+            task.job.circuit = getCircuitName(task.instance->key);
+            jobQueue.setCircuit(task.job.id, task.job.circuit);
+            proveQueue.push(task);
+            task.instance = nullptr;
+        }
+        proveQueue.close();
+    });
+    std::thread prover([&]() {
+#ifdef MULTICORE
+        omp_set_num_threads(config.num_threads);
+#endif
+        ProveTask task;
+        while (proveQueue.pop(task))
+        {
+            jobQueue.setState(task.job.id, Loopring::JobState::Proving);
+            // Keep the witness so the job doesn't need to start over when interrupted.
+            // The prover only reads the witness, so it is written while the block is being proven.
+            std::future<void> checkpointWritten;
+            if (checkpointWitness && task.job.checkpoint.length() == 0)
+            {
+                checkpointWritten = std::async(std::launch::async, [&]() {
+                    auto begin = now();
+                    std::string checkpoint = serverConfig.jobs_directory + "/" + std::to_string(task.job.id) + ".witness";
+                    if (Loopring::writeWitnessCheckpoint(checkpoint, task.instance->key, task.instance->getWitness()))
+                    {
+                        jobQueue.setCheckpoint(task.job.id, checkpoint);
+                        observePhase(begin, "checkpoint", task.instance->circuit.get());
+                    }
+                });
+            }
+            std::string error;
+            std::string jProof = proveJob(circuitCache, *task.instance, task.job, checkpointWritten, error);
+            if (error.length() != 0)
+            {
+                std::cerr << "Job " << task.job.id << " failed: " << error << std::endl;
+            }
+            Loopring::Metrics::getInstance().increment("prover_jobs_total", {{"result", error.length() == 0 ? "done" : "failed"}});
+            if (error.length() == 0)
+            {
+                jobQueue.recordDuration(task.job.circuit, elapsed_time_ms(task.begin) / 1000.0);
+                if (task.job.inputHash.length() != 0)
+                {
+                    proofCache.put(task.job.inputHash, jProof);
+                }
+            }
+            jobQueue.finish(task.job.id, jProof, error);
+            circuitCache.release(task.instance);
+        }
+    });
+
+    // Queues the job, blocks sent in the request that were already proven are done immediately
+    // (blocks in a file are looked up when the job is processed, so the file is not read here).
+    // Returns the job id, or 0 when the queue is full (when not waiting for space in the queue).
+    auto enqueueJob = [&](Loopring::Job& job, bool waitForSpace) -> uint64_t {
+        std::string cachedProof;
+        bool found = false;
+        try
+        {
+            if (job.block && proofCache.isEnabled())
+            {
+                found = findCachedProof(proofCache, job, getCircuitKey(*job.block), job.block->getHash(), cachedProof);
+            }
+            else if (job.input && proofCache.isEnabled())
+            {
+                found = findCachedProof(proofCache, job, job.input->get<Loopring::CircuitKey>(),
+                                        Loopring::hashBlock(*job.input), cachedProof);
+            }
+        }
+        catch (const std::exception& e)
+        {
+            // Invalid blocks are reported when the job is processed
+        }
+        if (found)
+        {
+            std::cout << "Returning cached proof for " << job.getDescription() << std::endl;
+            return jobQueue.add(job, cachedProof);
+        }
+        return waitForSpace ? jobQueue.pushWait(job) : jobQueue.push(job);
+    };
+
+    // Queues the job and sends back the job id, or the proof when waiting on the result
+    auto submitJob = [&](Loopring::Job& job, bool wait, httplib::Response& res) {
+        uint64_t jobID = enqueueJob(job, false);
+        if (jobID == 0)
+        {
+            res.status = 503;
+            res.set_content("Error: Job queue is full!\n", "text/plain");
+            return;
+        }
+
+        if (!wait)
         {
-            proverStatus.proving = true;
-            proverStatus.blockFilename = blockFilename;
-            proverStatus.proofFilename = proofFilename;
+            res.set_content(json{{"job_id", jobID}}.dump() + "\n", "application/json");
+            return;
         }
 
-        ~ProverStatusRAII()
+        // Keep the connection open until the proof is done
+        if (!jobQueue.wait(jobID, job))
+        {
+            res.set_content("Error: Prover stopped before the block was proven!\n", "text/plain");
+            return;
+        }
+        if (job.state == Loopring::JobState::Failed)
         {
-            proverStatus.proving = false;
+            res.set_content("Error: " + job.error + "\n", "text/plain");
+            return;
         }
+        // Return the proof
+        res.set_content(job.proof + "\n", "text/plain");
     };
 
-    // Setup the context a single time
-    ProverContextT context;
-    loadProvingKey(provingKeyFilename, context.provingKey);
-    context.constraint_system = &(circuit->getPb().constraint_system);
-    context.config = config;
-    context.domain = get_domain(circuit->getPb(), context.provingKey, config);
-    initProverContextBuffers(context);
+    // Parameters shared by all prove requests
+    auto readJobParameters = [&](const Request& req, Loopring::Job& job, Response& res) {
+        job.proofFilename = req.get_param_value("proof_filename");
+        job.validate = (req.get_param_value("validate").compare("true") == 0) ? true : false;
+        try
+        {
+            if (req.has_param("priority"))
+            {
+                job.priority = std::stoi(req.get_param_value("priority"));
+            }
+            if (req.has_param("deadline"))
+            {
+                job.deadline = std::stoull(req.get_param_value("deadline"));
+            }
+        }
+        catch (const std::exception& e)
+        {
+            res.status = 400;
+            res.set_content("Error: Invalid priority or deadline!\n", "text/plain");
+            return false;
+        }
+        return true;
+    };
 
-    // Prover status info
-    ProverStatus proverStatus;
-    // Lock for the prover
-    std::mutex mtx;
     // Setup the server
     Server svr;
     // Called to prove blocks
     svr.Get("/prove", [&](const Request& req, Response& res) {
-        const std::lock_guard<std::mutex> lock(mtx);
-
         // Parse the parameters
-        std::string blockFilename = req.get_param_value("block_filename");
-        std::string proofFilename = req.get_param_value("proof_filename");
-        std::string strValidate = req.get_param_value("validate");
-        bool validate = (strValidate.compare("true") == 0) ? true : false;
-        if (blockFilename.length() == 0)
+        Loopring::Job job;
+        job.blockFilename = req.get_param_value("block_filename");
+        if (!readJobParameters(req, job, res))
+        {
+            return;
+        }
+        bool wait = (req.get_param_value("wait").compare("true") == 0) ? true : false;
+        if (job.blockFilename.length() == 0)
         {
             res.set_content("Error: block_filename missing!\n", "text/plain");
             return;
         }
-
-        // Set the prover status for this session
-        ProverStatusRAII statusRAII(proverStatus, blockFilename, proofFilename);
-
-        // Prove the block
-        json input = loadJSON(blockFilename);
-        if (input == json())
+        submitJob(job, wait, res);
+    });
+    // Called to prove blocks sent in the request body
+    svr.Post("/prove", [&](const Request& req, Response& res, const ContentReader& contentReader) {
+        // Parse the parameters
+        Loopring::Job job;
+        if (!readJobParameters(req, job, res))
         {
-            res.set_content("Error: Failed to load block!\n", "text/plain");
             return;
         }
+        bool wait = (req.get_param_value("wait").compare("true") == 0) ? true : false;
 
-        // Some checks to see if this block is compatible with the loaded circuit
-        int iBlockType = input["blockType"].get<int>();
-        unsigned int blockSize = input["blockSize"].get<int>();
-        if (Loopring::BlockType(iBlockType) != circuit->getBlockType() || blockSize != circuit->getBlockSize())
+        // Decode the body and parse it into the block while it is being received
+        Loopring::StreamDecoder decoder(req.get_header_value("Content-Encoding"));
+        if (!decoder.isSupported())
         {
-            res.set_content("Error: Incompatible block requested! Use /info to check which blocks can be proven.\n", "text/plain");
+            res.status = 415;
+            res.set_content("Error: Unsupported Content-Encoding!\n", "text/plain");
             return;
         }
-
-        if (!generateWitness(circuit, input))
+        auto begin = now();
+        Loopring::JsonBlockReceiver receiver;
+        bool decoded = contentReader([&](const char* data, size_t length) {
+            return decoder.decode(data, length, [&](const char* data, size_t length) {
+                return receiver.receive(data, length);
+            });
+        });
+        std::string error;
+        std::shared_ptr<Loopring::ParsedBlock> block = receiver.finish(error);
+        if (!block)
         {
-            res.set_content("Error: Failed to generate witness for block!\n", "text/plain");
+            res.status = 400;
+            res.set_content(decoded ? "Error: Failed to parse block: " + error + "\n" : "Error: Failed to read block!\n", "text/plain");
             return;
         }
-        if (validate)
+        if (!decoded)
         {
-            if (!validateCircuit(circuit))
-            {
-                res.set_content("Error: Block is invalid!\n", "text/plain");
-                return;
-            }
+            res.status = 400;
+            res.set_content("Error: Failed to read block!\n", "text/plain");
+            return;
         }
-        std::string jProof = proveCircuit(context, circuit);
-        if (jProof.length() == 0)
+        observePhase(begin, "parse", nullptr);
+        job.block = block;
+        job.circuit = getCircuitName(getCircuitKey(*block));
+        submitJob(job, wait, res);
+    });
+    // Returns the state of a job (and the proof when it's done)
+    svr.Get(R"(/jobs/(\d+))", [&](const Request& req, Response& res) {
+        Loopring::Job job;
+        uint64_t id = 0;
+        try
+        {
+            id = std::stoull(req.matches[1]);
+        }
+        catch (const std::exception& e)
         {
-            res.set_content("Error: Failed to prove block!\n", "text/plain");
+            // Ids that don't fit in 64 bits can't belong to a job
+            res.status = 404;
+            res.set_content("Error: Unknown job!\n", "text/plain");
             return;
         }
-        if (proofFilename.length() != 0)
+        if (!jobQueue.get(id, job))
         {
-            if(!writeProof(jProof, proofFilename))
-            {
-                res.set_content("Error: Failed to write proof!\n", "text/plain");
-                return;
-            }
+            res.status = 404;
+            res.set_content("Error: Unknown job!\n", "text/plain");
+            return;
         }
-        // Return the proof
-        res.set_content(jProof + "\n", "text/plain");
+        json jJob = job;
+        Loopring::JobEstimate estimate;
+        if (jobQueue.getEstimate(job.id, estimate))
+        {
+            jJob["estimated_completion"] = estimate.estimatedCompletion;
+            jJob["at_risk"] = estimate.atRisk;
+        }
+        res.set_content(jJob.dump() + "\n", "application/json");
     });
     // Retuns the status of the server
     svr.Get("/status", [&](const Request& req, Response& res) {
-        if (proverStatus.proving)
-        {
-            std::string status = std::string("Proving ") + proverStatus.blockFilename;
-            res.set_content(status + "\n", "text/plain");
-        }
-        else
+        std::string status;
+        for (const Loopring::Job& job : jobQueue.getActive())
         {
-            res.set_content("Idle\n", "text/plain");
+            status += (job.state == Loopring::JobState::Witness ? "Generating witness for " : "Proving ") + job.getDescription() + "; ";
         }
+        status = (status.length() == 0) ? "Idle; " : status;
+        res.set_content(status + "Queued: " + std::to_string(jobQueue.numQueued()) +
+            "; At risk of missing deadline: " + std::to_string(jobQueue.getJobsAtRisk().size()) + "\n", "text/plain");
+    });
+    // Metrics in the Prometheus text format
+    svr.Get("/metrics", [&](const Request& req, Response& res) {
+        Loopring::Metrics& metrics = Loopring::Metrics::getInstance();
+        metrics.set("prover_queue_depth", {}, jobQueue.numQueued());
+        metrics.set("prover_jobs_active", {}, jobQueue.getActive().size());
+        metrics.set("prover_jobs_at_risk", {}, jobQueue.getJobsAtRisk().size());
+        metrics.set("prover_proof_cache_entries", {}, proofCache.size());
+        metrics.set("prover_memory_resident_bytes", {}, Loopring::getProcessStatus("VmRSS") * 1024.0);
+        metrics.set("prover_memory_peak_bytes", {}, Loopring::getProcessStatus("VmHWM") * 1024.0);
+        metrics.set("prover_memory_huge_pages_bytes", {}, Loopring::getHugePageMemory());
+        res.set_content(metrics.render(), "text/plain; version=0.0.4");
     });
     // Info of this prover server
     svr.Get("/info", [&](const Request& req, Response& res) {
-        std::string info = std::string("BlockType: ") + std::to_string(int(circuit->getBlockType())) +
-            std::string("; BlockSize: ") + std::to_string(circuit->getBlockSize()) + "\n";
-        res.set_content(info, "text/plain");
+        res.set_content(circuitCache.info().dump() + "\n", "application/json");
     });
     // Stops the prover server
     svr.Get("/stop", [&](const Request& req, Response& res) {
-        const std::lock_guard<std::mutex> lock(mtx);
+        jobQueue.stop();
         svr.stop();
     });
     // Default page contains help
     svr.Get("/", [&](const Request& req, Response& res) {
         std::string content;
         content += "Prover server:\n";
-        content += "- Prove a block: /prove?block_filename=<block.json>&proof_filename=<proof.json>&validate=true (proof_filename and validate are optional)\n";
+        content += "- Prove a block: /prove?block_filename=<block.json>&proof_filename=<proof.json>&validate=true&wait=false (proof_filename, validate and wait are optional)\n";
+        content += "  Queues the block and returns the job id. With wait=true the proof is returned when it's done.\n";
+        content += "  Optional priority=<int> (higher first) and deadline=<unix time> (earliest deadline first).\n";
+        content += "- Prove a block sent in the body: POST /prove?proof_filename=<proof.json>&validate=true&wait=false (gzip/zstd Content-Encoding if supported)\n";
+        content += "  Blocks that were already proven get their proof back immediately from the proof cache.\n";
+        content += "- Local operators can also submit CBOR encoded blocks over the Unix domain socket set in socket_path (see Utils/LocalChannel.h)\n";
+        content += "- Job state: /jobs/<id> (contains the proof when the job is done, and if the job is at risk of missing its deadline)\n";
         content += "- Status of the server: /status (busy proving a block or not)\n";
-        content += "- Info of the server: /info (which blocks can be proven)\n";
-        content += "- Shut down the server: /stop (will first finish generating the proof if busy)\n";
+        content += "- Metrics: /metrics (Prometheus text format)\n";
+        content += "- Info of the server: /info (which blocks can be proven and which circuits are loaded)\n";
+        content += "- Shut down the server: /stop (will first finish generating the proof if busy, queued jobs are resumed on restart,\n";
+        content += "  jobs with a generated witness continue from their witness checkpoint)\n";
         res.set_content(content, "text/plain");
     });
 
+    // Binary submission channel for an operator on the same host
+    Loopring::LocalServer localServer(serverConfig.socket_path, uint64_t(serverConfig.ring_size_mb) * 1024 * 1024,
+        [&](const Loopring::LocalRequest& request, std::string& error) -> uint64_t {
+            Loopring::Job job;
+            job.input = request.block;
+            job.validate = request.validate;
+            try
+            {
+                job.circuit = getCircuitName(job.input->get<Loopring::CircuitKey>());
+            }
+            catch (const std::exception& e)
+            {
+                error = std::string("Invalid block: ") + e.what();
+                return 0;
+            }
+            // Wait for space in the queue, the client waits on the full request ring in the meantime
+            uint64_t jobID = enqueueJob(job, true);
+            if (jobID == 0)
+            {
+                error = "Prover stopped before the block was queued!";
+            }
+            return jobID;
+        },
+        [&](uint64_t jobID, std::string& proof, std::string& error) {
+            Loopring::Job job;
+            if (!jobQueue.wait(jobID, job))
+            {
+                error = "Prover stopped before the block was proven!";
+                return false;
+            }
+            proof = job.proof;
+            error = job.error;
+            return job.state == Loopring::JobState::Done;
+        });
+    if (serverConfig.socket_path.length() != 0)
+    {
+        localServer.start();
+    }
+
     std::cout << "Running server on 'localhost' on port " << port << std::endl;
     svr.listen("127.0.0.1", port);
+
+    // Finish the jobs currently being worked on
+    jobQueue.stop();
+    localServer.stop();
+    witnessGenerator.join();
+    prover.join();
 }
 
 bool runBenchmark(Loopring::Circuit* circuit, const std::string& provingKeyFilename)
 {
-    // Load the proving key a single time
+    // The proving key is loaded once for each huge pages setting
     ProverContextT context;
-    loadProvingKey(provingKeyFilename, context.provingKey);
     context.constraint_system = &(circuit->getPb().constraint_system);
 
     VerificationKeyT vk = loadVerificationKey(provingKeyFilename.substr(0, provingKeyFilename.length() - 6) + "vk.json");
@@ -533,7 +1410,8 @@ bool runBenchmark(Loopring::Circuit* circuit, const std::string& provingKeyFilen
     BenchmarkConfig benchmarkConfig = loadJSON("benchmark.json").get<BenchmarkConfig>();
 
     // Create all configs
-    std::vector<libsnark::Config> configs;
+    std::vector<std::pair<libsnark::Config, bool>> configs;
+    for (auto huge_pages : benchmarkConfig.huge_pages) {
     for (auto num_threads : benchmarkConfig.num_threads) {
     for (auto smt : benchmarkConfig.smt) {
     for (auto prefetch_stride : benchmarkConfig.prefetch_stride) {
@@ -553,15 +1431,39 @@ bool runBenchmark(Loopring::Circuit* circuit, const std::string& provingKeyFilen
         config.multi_exp_c = multi_exp_c;
         config.multi_exp_prefetch_locality = multi_exp_prefetch_locality;
         config.multi_exp_look_ahead = multi_exp_look_ahead;
-        configs.push_back(config);
-    }}}}}}}}}
+        configs.push_back(std::make_pair(config, huge_pages));
+    }}}}}}}}}}
 
     unsigned int num_iterations = benchmarkConfig.num_iterations;
 
+    // The domain only depends on the circuit and the FFT settings,
+    // so it's only built once for all configs sharing these settings.
+    std::map<std::string, decltype(context.domain)> domains;
+    auto getDomain = [&](const libsnark::Config& config) {
+        std::string key = config.fft;
+        for (unsigned int radix : config.radixes)
+        {
+            key += "_" + std::to_string(radix);
+        }
+        auto it = domains.find(key);
+        if (it != domains.end())
+        {
+            return it->second;
+        }
+        auto begin = now();
+        auto domain = get_domain(circuit->getPb(), context.provingKey, config);
+        print_time(begin, "Domain created");
+        domains[key] = domain;
+        return domain;
+    };
+
     struct Result
     {
         libsnark::Config config;
+        std::string hugePages;
         unsigned int duration_ms;
+        // Average time spent in each phase of proving
+        std::map<std::string, double> phases_ms;
 
         static bool compareResult(Result a, Result b)
         {
@@ -569,19 +1471,39 @@ bool runBenchmark(Loopring::Circuit* circuit, const std::string& provingKeyFilen
         }
     };
     std::vector<Result> results;
-    for (auto config : configs)
+    bool keyLoaded = false;
+    bool keyHugePages = false;
+    for (const auto& configPair : configs)
     {
+        const libsnark::Config& config = configPair.first;
         std::cout << "*****************************" << std::endl;
-        std::cout << "Config: " << config << std::endl;
+        std::cout << "Config: " << config << "; huge pages: " << (configPair.second ? "on" : "off") << std::endl;
         std::cout << "*****************************" << std::endl;
 #ifdef MULTICORE
         omp_set_num_threads(config.num_threads);
 #endif
 
+        // Pages that were collapsed into huge pages are never split again, so the proving key (and the domains)
+        // are loaded again when the huge pages setting changes. The configs are ordered by this setting.
+        Loopring::setHugePagesEnabled(configPair.second);
+        releaseProverContextBuffers(context);
+        if (!keyLoaded || keyHugePages != configPair.second)
+        {
+            context.domain = nullptr;
+            domains.clear();
+            context.provingKey = ethsnarks::ProvingKeyT();
+            loadProvingKey(provingKeyFilename, context.provingKey);
+            keyLoaded = true;
+            keyHugePages = configPair.second;
+        }
+
         context.config = config;
-        context.domain = get_domain(circuit->getPb(), context.provingKey, config);
+        context.domain = getDomain(config);
+        // The prover buffers are allocated again for every config so they follow the huge pages setting
         initProverContextBuffers(context);
+        Loopring::printHugePageUsage();
 
+        std::map<std::string, double> phasesBefore = Loopring::Metrics::getInstance().getSums("prover_phase_duration_seconds", "phase");
         unsigned int totalTime = 0;
         for (unsigned int l = 0; l < num_iterations; l++)
         {
@@ -606,7 +1528,16 @@ bool runBenchmark(Loopring::Circuit* circuit, const std::string& provingKeyFilen
 
         Result result;
         result.config = config;
+        result.hugePages = Loopring::getHugePageStatus();
         result.duration_ms = totalTime / num_iterations;
+        for (const auto& phase : Loopring::Metrics::getInstance().getSums("prover_phase_duration_seconds", "phase"))
+        {
+            double seconds = phase.second - phasesBefore[phase.first];
+            if (seconds > 0.0)
+            {
+                result.phases_ms[phase.first] = seconds * 1000.0 / num_iterations;
+            }
+        }
         results.push_back(result);
     }
 
@@ -616,7 +1547,11 @@ bool runBenchmark(Loopring::Circuit* circuit, const std::string& provingKeyFilen
     for (unsigned int i = 0; i < results.size(); i++)
     {
         const libsnark::Config& config = results[i].config;
-        std::cout << i << ". " << config << " (" << results[i].duration_ms << "ms)" << std::endl;
+        std::cout << i << ". " << config << "; huge pages: " << results[i].hugePages << " (" << results[i].duration_ms << "ms)" << std::endl;
+        for (const auto& phase : results[i].phases_ms)
+        {
+            std::cout << "    " << phase.first << ": " << (unsigned int)(phase.second) << "ms" << std::endl;
+        }
     }
 
     return true;
@@ -629,6 +1564,7 @@ int main (int argc, char **argv)
     // Load in the config
     libsnark::Config config = loadConfig("config.json");
     std::cout << "Config: " << config << std::endl;
+    Loopring::setHugePagesEnabled(loadJSON("config.json").value("huge_pages", true));
 
 #ifdef MULTICORE
     // omp_set_nested is needed for gcc for some reason
@@ -641,23 +1577,27 @@ int main (int argc, char **argv)
     if (argc < 3)
     {
         std::cerr << "Usage: " << argv[0] << std::endl;
-        std::cerr << "-validate <block.json>: Validates a block" << std::endl;
-        std::cerr << "-prove <block.json> <out_proof.json>: Proves a block" << std::endl;
-        std::cerr << "-createkeys <protoBlock.json>: Creates prover/verifier keys" << std::endl;
+        std::cerr << "-validate <block.json|block.bin>: Validates a block" << std::endl;
+        std::cerr << "-prove <block.json|block.bin> <out_proof.json>: Proves a block" << std::endl;
+        std::cerr << "-createkeys <protoBlock.json|manifest.json>: Creates prover/verifier keys (for all circuits in the manifest)" << std::endl;
         std::cerr << "-verify <vk.json> <proof.json>: Verify a proof" << std::endl;
         std::cerr << "-exportcircuit <block.json> <circuit.json>: Exports the rc1s circuit to json (circom - not all fields)" << std::endl;
         std::cerr << "-exportwitness <block.json> <witness.json>: Exports the witness to json (circom)" << std::endl;
         std::cerr << "-createpk <block.json> <pk.json> <pk.raw>: Creates the proving key using a bellman pk" << std::endl;
         std::cerr << "-pk_alt2mcl <pk_alt.raw> <pk_mcl.raw>: Converts the proving key from the alt format to the mcl format" << std::endl;
         std::cerr << "-pk_mcl2nozk <pk_mlc.raw> <pk_nozk.raw>: Converts the proving key from the mcl format to the nozk format" << std::endl;
-        std::cerr << "-server <block.json> <port>: Keeps the program running as an HTTP server to prove blocks on demand" << std::endl;
-        std::cerr << "-benchmark <block.json>: Try out multiple prover options to find the fastest configuration on the system" << std::endl;
+        std::cerr << "-pk_raw2native <pk.raw> <pk.native>: Converts the proving key to the native format (used instead of <name>_pk.raw when found as <name>_pk.native)" << std::endl;
+        std::cerr << "-pk_raw2compressed <pk.raw> <pk.compressed>: Converts the proving key to the compressed format (used when <name>_pk.raw is missing)" << std::endl;
+        std::cerr << "-pk_raw2sparse <pk.raw> <pk.compressed>: Converts the proving key to the compressed format without the points at infinity" << std::endl;
+        std::cerr << "-pk_compressed2native <pk.compressed> <pk.native> [pk.raw]: Converts the compressed proving key to the native format (checked against the raw pk when given)" << std::endl;
+        std::cerr << "-server <block.json|manifest.json> <port>: Keeps the program running as an HTTP server to prove blocks on demand" << std::endl;
+        std::cerr << "-benchmark <block.json|block.bin>: Try out multiple prover options to find the fastest configuration on the system" << std::endl;
+        std::cerr << "-block_json2bin <block.json> <block.bin>: Converts a block to the binary block format (much faster to load)" << std::endl;
         return 1;
     }
 
     const char* proofFilename = NULL;
     Mode mode = Mode::Validate;
-    std::string baseFilename = "keys/";
     if (strcmp(argv[1], "-validate") == 0)
     {
         mode = Mode::Validate;
@@ -766,6 +1706,66 @@ int main (int argc, char **argv)
         std::cout << "Successfully created pk " << argv[3] << "." << std::endl;
         return 0;
     }
+    else if (strcmp(argv[1], "-pk_raw2native") == 0)
+    {
+        if (argc != 4)
+        {
+            std::cout << "Invalid number of arguments!"<< std::endl;
+            return 1;
+        }
+        std::cout << "Converting pk from " << argv[2] << " to " << argv[3] << " ..." << std::endl;
+        auto begin = now();
+        auto pk = ethsnarks::load_proving_key(argv[2]);
+        if (!Loopring::writeNativeProvingKey(pk, argv[2], argv[3]) || !Loopring::verifyProvingKey(pk, argv[3]))
+        {
+            std::cout << "Failed to convert!"<< std::endl;
+            return 1;
+        }
+        print_time(begin, "Proving key converted");
+        std::cout << "Successfully created pk " << argv[3] << "." << std::endl;
+        return 0;
+    }
+    else if (strcmp(argv[1], "-pk_raw2compressed") == 0 || strcmp(argv[1], "-pk_raw2sparse") == 0 ||
+             strcmp(argv[1], "-pk_compressed2native") == 0)
+    {
+        if (argc != 4 && !(argc == 5 && strcmp(argv[1], "-pk_compressed2native") == 0))
+        {
+            std::cout << "Invalid number of arguments!"<< std::endl;
+            return 1;
+        }
+        std::cout << "Converting pk from " << argv[2] << " to " << argv[3] << " ..." << std::endl;
+        auto begin = now();
+        bool converted = false;
+        if (strcmp(argv[1], "-pk_compressed2native") != 0)
+        {
+            auto pk = ethsnarks::load_proving_key(argv[2]);
+            converted = Loopring::writeCompressedProvingKey(pk, argv[3], strcmp(argv[1], "-pk_raw2sparse") == 0) &&
+                        Loopring::verifyProvingKey(pk, argv[3]);
+        }
+        else
+        {
+            // Streamed, only a batch of points is decompressed in memory at a time
+            converted = Loopring::convertCompressedToNativeProvingKey(argv[2], argv[3]);
+            if (converted && argc == 5)
+            {
+                // Checked against the raw pk the compressed pk was created from (loaded by ethsnarks)
+                auto pk = ethsnarks::load_proving_key(argv[4]);
+                converted = Loopring::verifyProvingKey(pk, argv[3]);
+            }
+            else if (converted)
+            {
+                converted = Loopring::verifyProvingKey(argv[2], argv[3]);
+            }
+        }
+        if (!converted)
+        {
+            std::cout << "Failed to convert!"<< std::endl;
+            return 1;
+        }
+        print_time(begin, "Proving key converted");
+        std::cout << "Successfully created pk " << argv[3] << "." << std::endl;
+        return 0;
+    }
     else if (strcmp(argv[1], "-server") == 0)
     {
         if (argc != 4)
@@ -786,53 +1786,169 @@ int main (int argc, char **argv)
         mode = Mode::Benchmark;
         std::cout << "Benchmarking " << argv[2] << "..." << std::endl;
     }
+    else if (strcmp(argv[1], "-block_json2bin") == 0)
+    {
+        if (argc != 4)
+        {
+            std::cout << "Invalid number of arguments!"<< std::endl;
+            return 1;
+        }
+        std::cout << "Converting block " << argv[2] << " to " << argv[3] << "..." << std::endl;
+        auto begin = now();
+        std::unique_ptr<Loopring::BlockFile> input = openBlockFile(argv[2]);
+        if (!input || !convertBlockToBinary(*input, argv[3]))
+        {
+            std::cout << "Failed to convert!"<< std::endl;
+            return 1;
+        }
+        print_time(begin, "Block converted");
+        std::cout << "Successfully created block " << argv[3] << "." << std::endl;
+        return 0;
+    }
     else
     {
         std::cerr << "Unknown option: " << argv[1] << std::endl;
         return 1;
     }
 
-    // Read the block file
-    json input = loadJSON(argv[2]);
-    if (input == json())
+    // Manifests are read as a json document, blocks are read directly into the block classes
+    json input;
+    std::unique_ptr<Loopring::BlockFile> blockFile;
+    if ((mode == Mode::Server || mode == Mode::CreateKeys) && !Loopring::isBinaryBlock(argv[2]))
     {
-        return 1;
+        input = loadJSON(argv[2]);
+        if (input == json())
+        {
+            return 1;
+        }
+    }
+    else
+    {
+        if (mode == Mode::Server)
+        {
+            std::cerr << "The server needs a JSON block or manifest!" << std::endl;
+            return 1;
+        }
+        blockFile = openBlockFile(argv[2]);
+        if (!blockFile)
+        {
+            return 1;
+        }
     }
 
-    // Read meta data
-    int iBlockType = input["blockType"].get<int>();
-    unsigned int blockSize = input["blockSize"].get<int>();
-    bool onchainDataAvailability = input["onchainDataAvailability"].get<bool>();
-    std::string strOnchainDataAvailability = onchainDataAvailability ? "_DA_" : "_";
-    std::string postFix = strOnchainDataAvailability + std::to_string(blockSize);
+    if (mode == Mode::Server)
+    {
+        // Either a manifest with all circuits to host or a single block
+        std::vector<Loopring::CircuitKey> circuits;
+        std::vector<Loopring::CircuitKey> preload;
+        if (input.contains("circuits"))
+        {
+            for (const json& jCircuit : input["circuits"])
+            {
+                circuits.push_back(jCircuit.get<Loopring::CircuitKey>());
+                if (jCircuit.contains("preload") && jCircuit["preload"].get<bool>())
+                {
+                    preload.push_back(circuits.back());
+                }
+            }
+        }
+        else
+        {
+            circuits.push_back(input.get<Loopring::CircuitKey>());
+            preload.push_back(circuits.back());
+        }
+
+        for (const Loopring::CircuitKey& key : circuits)
+        {
+            if (int(key.blockType) >= int(Loopring::BlockType::COUNT))
+            {
+                std::cerr << "Invalid block type: " << int(key.blockType) << std::endl;
+                return 1;
+            }
+            if (!provingKeyExists(getProvingKeyFilename(getBaseFilename(key))))
+            {
+                std::cerr << "Failed to find pk for " << key.toString() << "!" << std::endl;
+                return 1;
+            }
+        }
+
+#ifdef MULTICORE
+        omp_set_num_threads(config.num_threads);
+        std::cout << "Num threads used: " << omp_get_max_threads() << std::endl;
+#endif
+        runServer(circuits, preload, config, loadServerConfig("config.json"), std::stoi(argv[3]));
+        return 0;
+    }
+
+    if (mode == Mode::CreateKeys && input.contains("circuits"))
+    {
+        // Keys for all circuits in the manifest, only a single circuit is kept in memory at a time
+#ifdef MULTICORE
+        omp_set_num_threads(config.num_threads);
+        std::cout << "Num threads used: " << omp_get_max_threads() << std::endl;
+#endif
+        auto begin = now();
+        for (const json& jCircuit : input["circuits"])
+        {
+            Loopring::CircuitKey key = jCircuit.get<Loopring::CircuitKey>();
+            if (int(key.blockType) >= int(Loopring::BlockType::COUNT))
+            {
+                std::cerr << "Invalid block type: " << int(key.blockType) << std::endl;
+                return 1;
+            }
+            if (!createKeys(key, config))
+            {
+                return 1;
+            }
+            printMemoryUsage();
+        }
+        print_time(begin, "All keys created");
+        return 0;
+    }
 
-    if (iBlockType >= int(Loopring::BlockType::COUNT))
+    // Read meta data
+    Loopring::CircuitKey key = blockFile ? getCircuitKey(*blockFile) : input.get<Loopring::CircuitKey>();
+    if (int(key.blockType) >= int(Loopring::BlockType::COUNT))
     {
-        std::cerr << "Invalid block type: " << iBlockType << std::endl;
+        std::cerr << "Invalid block type: " << int(key.blockType) << std::endl;
         return 1;
     }
-    Loopring::BlockType blockType = Loopring::BlockType(iBlockType);
-    baseFilename += getBaseName(blockType) + postFix;
+    std::string baseFilename = getBaseFilename(key);
     std::string provingKeyFilename = getProvingKeyFilename(baseFilename);
 
-    if (mode == Mode::Prove || mode == Mode::Server)
+    if (mode == Mode::Prove)
     {
-        if (!fileExists(provingKeyFilename))
+        if (!provingKeyExists(provingKeyFilename))
         {
             std::cerr << "Failed to find pk!" << std::endl;
             return 1;
         }
     }
 
+    // When proving, the proving key is loaded while the circuit is constructed and the witness is generated
+    StartupReport startup;
+    ProverContextT context;
+    std::future<void> provingKeyLoaded;
+#ifndef GPU_PROVE
+    if (mode == Mode::Prove)
+    {
+        provingKeyLoaded = std::async(std::launch::async, [&]() {
+            auto begin = now();
+            loadProvingKey(provingKeyFilename, context.provingKey);
+            startup.add("load proving key", elapsed_time_ms(begin));
+        });
+    }
+#endif
+
+    auto constructBegin = now();
     ethsnarks::ProtoboardT pb;
-    Loopring::Circuit* circuit = createCircuit(blockType, blockSize, onchainDataAvailability, pb);
-    if (config.swapAB)
+    Loopring::Circuit* circuit = createCircuit(key.blockType, key.blockSize, key.onchainDataAvailability, pb);
+    if (circuit == nullptr)
     {
-        pb.constraint_system.swap_AB_if_beneficial();
+        return 1;
     }
-    pb.constraint_system.constraints.shrink_to_fit();
-    pb.values.shrink_to_fit();
-    libsnark::ConstantStorage<FieldT>::getInstance().constants.shrink_to_fit();
+    optimizeCircuit(pb, config);
+    startup.add("construct circuit", elapsed_time_ms(constructBegin));
 
     printMemoryUsage();
 
@@ -850,7 +1966,7 @@ int main (int argc, char **argv)
 
     if (mode == Mode::Benchmark)
     {
-        if (!generateWitness(circuit, input))
+        if (!generateWitness(circuit, *blockFile))
         {
             return 1;
         }
@@ -862,25 +1978,24 @@ int main (int argc, char **argv)
     std::cout << "Num threads used: " << omp_get_max_threads() << std::endl;
 #endif
 
-    if (mode == Mode::Server)
-    {
-        runServer(circuit, provingKeyFilename, config, std::stoi(argv[3]));
-    }
-
     if (mode == Mode::Validate || mode == Mode::Prove)
     {
-        if (!generateWitness(circuit, input))
+        auto begin = now();
+        if (!generateWitness(circuit, *blockFile))
         {
             return 1;
         }
+        startup.add("generate witness", elapsed_time_ms(begin));
     }
 
     if (mode == Mode::Validate || mode == Mode::Prove)
     {
+        auto begin = now();
         if (!validateCircuit(circuit))
         {
             return 1;
         }
+        startup.add("validate", elapsed_time_ms(begin));
     }
 
     if (mode == Mode::CreateKeys)
@@ -901,12 +2016,15 @@ int main (int argc, char **argv)
         stub_write_input_from_pb(pb, provingKeyFilename.c_str(), inputsFilename.c_str());
         print_time(begin, "write input");
 #else
-        ProverContextT context;
-        loadProvingKey(provingKeyFilename, context.provingKey);
+        provingKeyLoaded.get();
+        auto begin = now();
         context.constraint_system = &pb.constraint_system;
         context.config = config;
         context.domain = get_domain(pb, context.provingKey, config);
         initProverContextBuffers(context);
+        startup.add("setup prover context", elapsed_time_ms(begin));
+        startup.print();
+        Loopring::printHugePageUsage();
         printMemoryUsage();
         std::string jProof = proveCircuit(context, circuit);
         if (jProof.length() == 0)
@@ -0,0 +1,84 @@
+#include "../ThirdParty/catch.hpp"
+#include "TestUtils.h"
+
+#include "../Utils/BlockIO.h"
+
+TEST_CASE("BlockIO", "[BlockIO]")
+{
+    RingSettlementBlock block = getRingSettlementBlock();
+    REQUIRE(block.ringSettlements.size() > 0);
+
+    BlockWriter writer;
+    writer(block);
+
+    SECTION("Round trip")
+    {
+        RingSettlementBlock decoded;
+        BlockReader reader(writer.data.data(), writer.data.size());
+        reader(decoded);
+        REQUIRE(reader.isValid());
+
+        REQUIRE(decoded.exchangeID == block.exchangeID);
+        REQUIRE(decoded.merkleRootBefore == block.merkleRootBefore);
+        REQUIRE(decoded.merkleRootAfter == block.merkleRootAfter);
+        REQUIRE(decoded.signature.R.x == block.signature.R.x);
+        REQUIRE(decoded.signature.R.y == block.signature.R.y);
+        REQUIRE(decoded.signature.s == block.signature.s);
+        REQUIRE(decoded.ringSettlements.size() == block.ringSettlements.size());
+        for (unsigned int i = 0; i < block.ringSettlements.size(); i++)
+        {
+            const RingSettlement& a = decoded.ringSettlements[i];
+            const RingSettlement& b = block.ringSettlements[i];
+            REQUIRE(a.ring.orderA.amountS == b.ring.orderA.amountS);
+            REQUIRE(a.ring.orderB.signature.s == b.ring.orderB.signature.s);
+            REQUIRE(a.balanceUpdateS_A.proof.data == b.balanceUpdateS_A.proof.data);
+            REQUIRE(a.accountUpdate_B.after.publicKey.x == b.accountUpdate_B.after.publicKey.x);
+            REQUIRE(a.balanceUpdateB_O.rootAfter == b.balanceUpdateB_O.rootAfter);
+        }
+
+        // Everything was read back, so writing the decoded block gives the same data
+        BlockWriter rewriter;
+        rewriter(decoded);
+        REQUIRE(rewriter.data == writer.data);
+    }
+
+    SECTION("Truncated data")
+    {
+        RingSettlementBlock decoded;
+        BlockReader reader(writer.data.data(), writer.data.size() - 1);
+        reader(decoded);
+        REQUIRE(!reader.isValid());
+    }
+
+    SECTION("Trailing data")
+    {
+        writer.data.push_back(0);
+        RingSettlementBlock decoded;
+        BlockReader reader(writer.data.data(), writer.data.size());
+        reader(decoded);
+        REQUIRE(!reader.isValid());
+    }
+
+    SECTION("File")
+    {
+        string filename = "block_io_test.bin";
+        REQUIRE(writeBinaryBlock(filename, BlockType::RingSettlement, 4, true, block));
+        REQUIRE(isBinaryBlock(filename));
+
+        BinaryBlock binaryBlock;
+        REQUIRE(binaryBlock.open(filename));
+        REQUIRE(binaryBlock.getBlockType() == BlockType::RingSettlement);
+        REQUIRE(binaryBlock.getBlockSize() == 4);
+        REQUIRE(binaryBlock.getOnchainDataAvailability());
+
+        RingSettlementBlock decoded;
+        REQUIRE(binaryBlock.read(decoded));
+        REQUIRE(decoded.merkleRootAfter == block.merkleRootAfter);
+        REQUIRE(decoded.ringSettlements.size() == block.ringSettlements.size());
+
+        // A block of another type doesn't match the layout
+        DepositBlock depositBlock;
+        REQUIRE(!binaryBlock.read(depositBlock));
+        std::remove(filename.c_str());
+    }
+}
@@ -0,0 +1,293 @@
+#include "../ThirdParty/catch.hpp"
+#include "TestUtils.h"
+
+#include "../Utils/BlockIO.h"
+#include "../Utils/BlockJson.h"
+
+TEST_CASE("BlockJson", "[BlockJson]")
+{
+    string filename = string(TEST_DATA_PATH) + "settlement_block.json";
+    JsonBlock jsonBlock;
+    REQUIRE(jsonBlock.open(filename));
+
+    SECTION("Meta data")
+    {
+        json input;
+        ifstream file(filename);
+        file >> input;
+        REQUIRE(int(jsonBlock.getBlockType()) == input["blockType"].get<int>());
+        REQUIRE(jsonBlock.getBlockSize() == input["blockSize"].get<unsigned int>());
+        REQUIRE(jsonBlock.getOnchainDataAvailability() == input["onchainDataAvailability"].get<bool>());
+    }
+
+    SECTION("Same as from_json")
+    {
+        RingSettlementBlock block;
+        REQUIRE(jsonBlock.read(block));
+        RingSettlementBlock expected = getRingSettlementBlock();
+        REQUIRE(block.ringSettlements.size() == expected.ringSettlements.size());
+
+        // Compare all values
+        BlockWriter writer;
+        writer(block);
+        BlockWriter expectedWriter;
+        expectedWriter(expected);
+        REQUIRE(writer.data == expectedWriter.data);
+    }
+
+    SECTION("Wrong block type")
+    {
+        DepositBlock block;
+        REQUIRE(!jsonBlock.read(block));
+    }
+}
+
+TEST_CASE("BlockJson delta proofs", "[BlockJson]")
+{
+    json input;
+    ifstream file(string(TEST_DATA_PATH) + "settlement_block.json");
+    file >> input;
+    RingSettlementBlock expected = input.get<RingSettlementBlock>();
+
+    // balanceUpdateB_O of the first ring is proof 13, balanceUpdateA_O is proof 12
+    json& ring = input["ringSettlements"][0];
+    const json& baseProof = ring["balanceUpdateA_O"]["proof"];
+    const json& fullProof = ring["balanceUpdateB_O"]["proof"];
+    json deltaProof;
+    deltaProof["base"] = 12;
+    deltaProof["indices"] = json::array();
+    deltaProof["siblings"] = json::array();
+    for (unsigned int i = 0; i < fullProof.size(); i++)
+    {
+        if (fullProof[i] != baseProof[i])
+        {
+            deltaProof["indices"].push_back(i);
+            deltaProof["siblings"].push_back(fullProof[i]);
+        }
+    }
+    unsigned int numSiblings = fullProof.size();
+    REQUIRE(deltaProof["indices"].size() < numSiblings);
+    ring["balanceUpdateB_O"]["proof"] = deltaProof;
+
+    BlockWriter expectedWriter;
+    expectedWriter(expected);
+
+    SECTION("from_json")
+    {
+        RingSettlementBlock block = input.get<RingSettlementBlock>();
+        BlockWriter writer;
+        writer(block);
+        REQUIRE(writer.data == expectedWriter.data);
+    }
+
+    SECTION("JsonBlock")
+    {
+        string filename = "block_json_test.json";
+        ofstream(filename) << input.dump();
+        JsonBlock jsonBlock;
+        REQUIRE(jsonBlock.open(filename));
+        RingSettlementBlock block;
+        REQUIRE(jsonBlock.read(block));
+        std::remove(filename.c_str());
+
+        BlockWriter writer;
+        writer(block);
+        REQUIRE(writer.data == expectedWriter.data);
+    }
+
+    SECTION("Invalid base proof")
+    {
+        ring["balanceUpdateB_O"]["proof"]["base"] = 13;
+        REQUIRE_THROWS(input.get<RingSettlementBlock>());
+    }
+
+    SECTION("Invalid sibling index")
+    {
+        ring["balanceUpdateB_O"]["proof"]["indices"].push_back(numSiblings);
+        ring["balanceUpdateB_O"]["proof"]["siblings"].push_back("0");
+        REQUIRE_THROWS(input.get<RingSettlementBlock>());
+    }
+}
+
+TEST_CASE("BlockJson hash", "[BlockJson]")
+{
+    json input;
+    ifstream file(string(TEST_DATA_PATH) + "settlement_block.json");
+    file >> input;
+    string hash = hashBlock(input);
+    REQUIRE(hash.length() != 0);
+
+    SECTION("JSON file")
+    {
+        // Formatting doesn't matter
+        string filename = "block_hash_test.json";
+        ofstream(filename) << input.dump(4);
+        JsonBlock jsonBlock;
+        REQUIRE(jsonBlock.open(filename));
+        REQUIRE(jsonBlock.getHash() == hash);
+
+        ParsedBlock parsedBlock;
+        REQUIRE(parsedBlock.load(jsonBlock));
+        REQUIRE(parsedBlock.getHash() == hash);
+        RingSettlementBlock block;
+        REQUIRE(parsedBlock.read(block));
+        REQUIRE(parsedBlock.getHash() == hash);
+        std::remove(filename.c_str());
+    }
+
+    SECTION("Binary block")
+    {
+        string filename = "block_hash_test.bin";
+        REQUIRE(writeBinaryBlock(filename, BlockType(input["blockType"].get<int>()), input["blockSize"].get<unsigned int>(),
+                                 input["onchainDataAvailability"].get<bool>(), input.get<RingSettlementBlock>()));
+        BinaryBlock binaryBlock;
+        REQUIRE(binaryBlock.open(filename));
+        REQUIRE(binaryBlock.getHash() == hash);
+        REQUIRE(hashBlock(static_cast<const BlockFile&>(binaryBlock)) == hash);
+        std::remove(filename.c_str());
+    }
+
+    SECTION("Received with a delta proof")
+    {
+        // balanceUpdateB_O of the first ring is proof 13, sent as a delta to proof 12
+        json& ring = input["ringSettlements"][0];
+        json deltaProof = ring["balanceUpdateB_O"]["proof"];
+        json& baseProof = ring["balanceUpdateA_O"]["proof"];
+        json indices = json::array();
+        json siblings = json::array();
+        for (unsigned int i = 0; i < deltaProof.size(); i++)
+        {
+            if (deltaProof[i] != baseProof[i])
+            {
+                indices.push_back(i);
+                siblings.push_back(deltaProof[i]);
+            }
+        }
+        ring["balanceUpdateB_O"]["proof"] = {{"base", 12}, {"indices", indices}, {"siblings", siblings}};
+        REQUIRE(hashBlock(input) == hash);
+
+        JsonBlockReceiver receiver;
+        string str = input.dump(2);
+        REQUIRE(receiver.receive(str.data(), str.size()));
+        string error;
+        std::shared_ptr<ParsedBlock> block = receiver.finish(error);
+        REQUIRE(block);
+        REQUIRE(block->getHash() == hash);
+    }
+
+    SECTION("Different block")
+    {
+        input["blockSize"] = input["blockSize"].get<unsigned int>() * 2;
+        REQUIRE(hashBlock(input) != hash);
+    }
+}
+
+TEST_CASE("BlockJson members", "[BlockJson]")
+{
+    auto parse = [](const string& str, BalanceLeaf& leaf) {
+        string error;
+        return parseJsonBlock(str.data(), str.size(), jsonTarget(leaf), false, error);
+    };
+
+    BalanceLeaf leaf;
+    REQUIRE(parse(R"({"balance": "1", "tradingHistoryRoot": "2", "unknown": [1, {"a": 2}]})", leaf));
+    REQUIRE((leaf.balance == FieldT(1)));
+    REQUIRE((leaf.tradingHistoryRoot == FieldT(2)));
+
+    SECTION("Missing member")
+    {
+        REQUIRE(!parse(R"({"balance": "1"})", leaf));
+    }
+
+    SECTION("Repeated member hiding a missing member")
+    {
+        REQUIRE(!parse(R"({"balance": "1", "balance": "2"})", leaf));
+    }
+
+    SECTION("Repeated list")
+    {
+        DepositBlock block;
+        json input = {{"deposits", json::array()}, {"exchangeID", 0}};
+        string str = input.dump();
+        str.insert(str.size() - 1, R"(, "deposits": [])");
+        string error;
+        REQUIRE(!parseJsonBlock(str.data(), str.size(), jsonTarget(block), false, error));
+        REQUIRE(error.find("duplicate") != string::npos);
+    }
+}
+
+TEST_CASE("BlockJson receiver", "[BlockJson]")
+{
+    json input;
+    ifstream file(string(TEST_DATA_PATH) + "settlement_block.json");
+    file >> input;
+    BlockWriter expectedWriter;
+    expectedWriter(input.get<RingSettlementBlock>());
+
+    // The keys are sorted, so accountUpdate_O and accountUpdate_P are received before blockType
+    auto receive = [](const string& str, size_t chunkSize, string& error) {
+        JsonBlockReceiver receiver;
+        for (size_t i = 0; i < str.size(); i += chunkSize)
+        {
+            if (!receiver.receive(str.data() + i, std::min(chunkSize, str.size() - i)))
+            {
+                break;
+            }
+        }
+        return receiver.finish(error);
+    };
+
+    SECTION("Same as from_json")
+    {
+        string str = input.dump();
+        for (size_t chunkSize : {size_t(1000), size_t(65536), str.size()})
+        {
+            string error;
+            std::shared_ptr<ParsedBlock> block = receive(str, chunkSize, error);
+            REQUIRE(block);
+            REQUIRE(block->getBlockType() == BlockType::RingSettlement);
+            REQUIRE(block->getHash() == hashBlock(input));
+
+            RingSettlementBlock parsed;
+            REQUIRE(block->read(parsed));
+            BlockWriter writer;
+            writer(parsed);
+            REQUIRE(writer.data == expectedWriter.data);
+            // The block is moved out
+            REQUIRE(!block->read(parsed));
+        }
+    }
+
+    SECTION("Wrong block type")
+    {
+        string error;
+        std::shared_ptr<ParsedBlock> block = receive(input.dump(), 65536, error);
+        REQUIRE(block);
+        DepositBlock parsed;
+        REQUIRE(!block->read(parsed));
+    }
+
+    SECTION("Missing member")
+    {
+        input.erase("accountUpdate_O");
+        string error;
+        REQUIRE(!receive(input.dump(), 65536, error));
+        REQUIRE(error.find("accountUpdate_O") != string::npos);
+    }
+
+    SECTION("Transactions of another block type")
+    {
+        input["deposits"] = input["ringSettlements"];
+        input.erase("ringSettlements");
+        string error;
+        REQUIRE(!receive(input.dump(), 65536, error));
+    }
+
+    SECTION("Invalid JSON")
+    {
+        string str = input.dump();
+        string error;
+        REQUIRE(!receive(str.substr(0, str.size() / 2), 65536, error));
+        REQUIRE(!receive(str + "}", 65536, error));
+    }
+}
@@ -0,0 +1,103 @@
+#include "../ThirdParty/catch.hpp"
+#include "TestUtils.h"
+
+#include "../Utils/FieldParser.h"
+
+#include <chrono>
+
+static FieldT parseField(const string& str)
+{
+    FieldT value;
+    REQUIRE(parseFieldElement(str.c_str(), value));
+    return value;
+}
+
+// Random limbs reduced mod p, so (almost) all values have the full 254 bits
+static BigInt getFullWidthFieldElementAsBigInt()
+{
+    BigInt v(0);
+    for (unsigned int i = 0; i < 256 / 16; i++)
+    {
+        v *= 65536;
+        v += rand() & 0xffff;
+    }
+    v %= SNARK_SCALAR_FIELD;
+    return v;
+}
+
+TEST_CASE("FieldParser", "[FieldParser]")
+{
+    SECTION("Decimal")
+    {
+        REQUIRE((parseField("0") == FieldT::zero()));
+        REQUIRE((parseField("1") == FieldT::one()));
+        REQUIRE((parseField("1234567890123456789") == FieldT("1234567890123456789")));
+        REQUIRE((parseField("12345678901234567890") == FieldT("12345678901234567890")));
+        REQUIRE((parseField("00000000000000000000000000042") == FieldT("42")));
+        REQUIRE((parseField(SNARK_SCALAR_FIELD.to_string()) == FieldT::zero()));
+
+        for (unsigned int n = 0; n < 1000; n++)
+        {
+            string str = getRandomFieldElementAsBigInt(rand() % 254 + 1).to_string();
+            REQUIRE((parseField(str) == FieldT(str.c_str())));
+        }
+        for (unsigned int n = 0; n < 1000; n++)
+        {
+            string str = getFullWidthFieldElementAsBigInt().to_string();
+            REQUIRE((parseField(str) == FieldT(str.c_str())));
+        }
+    }
+
+    SECTION("Hexadecimal")
+    {
+        REQUIRE((parseField("0x0") == FieldT::zero()));
+        REQUIRE((parseField("0xff") == FieldT("255")));
+        REQUIRE((parseField("0XFF") == FieldT("255")));
+        REQUIRE((parseField("0x1000000000000000") == FieldT("1152921504606846976")));
+        REQUIRE((parseField("0x30644e72e131a029b85045b68181585d2833e84879b9709143e1f593f0000000") == getMaxFieldElement()));
+    }
+
+    SECTION("Invalid")
+    {
+        FieldT value;
+        REQUIRE(!parseFieldElement("", value));
+        REQUIRE(!parseFieldElement("0x", value));
+        REQUIRE(!parseFieldElement("-1", value));
+        REQUIRE(!parseFieldElement("12a", value));
+        REQUIRE(!parseFieldElement("0x12g", value));
+        // 2^256
+        REQUIRE(!parseFieldElement("115792089237316195423570985008687907853269984665640564039457584007913129639936", value));
+        REQUIRE(!parseFieldElement("0x10000000000000000000000000000000000000000000000000000000000000000", value));
+    }
+}
+
+TEST_CASE("FieldParser benchmark", "[.][FieldParser][benchmark]")
+{
+    vector<string> values;
+    for (unsigned int n = 0; n < 100000; n++)
+    {
+        values.push_back(getFullWidthFieldElementAsBigInt().to_string());
+    }
+
+    FieldT sum = FieldT::zero();
+    auto begin = chrono::steady_clock::now();
+    for (const string& str : values)
+    {
+        sum += FieldT(str.c_str());
+    }
+    auto libffDuration = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - begin).count();
+
+    FieldT fastSum = FieldT::zero();
+    begin = chrono::steady_clock::now();
+    for (const string& str : values)
+    {
+        FieldT value;
+        parseFieldElement(str.c_str(), value);
+        fastSum += value;
+    }
+    auto fastDuration = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - begin).count();
+
+    cout << "FieldT(str): " << libffDuration / 1000 << "ms, parseFieldElement: " << fastDuration / 1000 << "ms ("
+         << values.size() << " field elements)" << endl;
+    REQUIRE((sum == fastSum));
+}
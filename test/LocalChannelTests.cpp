@@ -0,0 +1,143 @@
+#include "../ThirdParty/catch.hpp"
+#include "TestUtils.h"
+
+#include "../Utils/LocalChannel.h"
+
+#include <chrono>
+#include <thread>
+
+static bool waitForConnections(const LocalServer& server, size_t numConnections)
+{
+    for (unsigned int i = 0; i < 500 && server.getNumConnections() != numConnections; i++)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return server.getNumConnections() == numConnections;
+}
+
+TEST_CASE("LocalChannel", "[LocalChannel]")
+{
+    string path = "/tmp/loopring_prover_test_" + std::to_string(getpid()) + ".sock";
+
+    // Every block is "proven" by returning it as the proof
+    std::mutex mtx;
+    std::map<uint64_t, json> blocks;
+    uint64_t nextJobID = 1;
+    LocalServer server(path, 1024 * 1024,
+        [&](const LocalRequest& request, std::string& error) -> uint64_t {
+            std::lock_guard<std::mutex> lock(mtx);
+            if (request.block->contains("invalid"))
+            {
+                error = "Invalid block";
+                return 0;
+            }
+            blocks[nextJobID] = *request.block;
+            blocks[nextJobID]["validate"] = request.validate;
+            return nextJobID++;
+        },
+        [&](uint64_t jobID, std::string& proof, std::string& error) {
+            std::lock_guard<std::mutex> lock(mtx);
+            proof = blocks[jobID].dump();
+            return true;
+        });
+    REQUIRE(server.start());
+
+    SECTION("Round trip")
+    {
+        {
+            LocalClient client;
+            REQUIRE(client.connect(path));
+            REQUIRE(waitForConnections(server, 1));
+
+            std::vector<json> sent;
+            for (unsigned int i = 0; i < 10; i++)
+            {
+                json block = {{"blockType", 0}, {"blockSize", i}, {"data", std::string(i * 1000, 'x')}};
+                REQUIRE(client.send(100 + i, block, i % 2 == 0));
+                block["validate"] = (i % 2 == 0);
+                sent.push_back(block);
+            }
+            REQUIRE(client.send(200, json{{"invalid", true}}, false));
+
+            // Responses are sent in the order the requests were queued, rejected requests are answered immediately
+            std::map<uint64_t, json> proofs;
+            std::map<uint64_t, std::string> errors;
+            for (unsigned int i = 0; i < sent.size() + 1; i++)
+            {
+                uint64_t id = 0;
+                json proof;
+                std::string error;
+                REQUIRE(client.receive(id, proof, error));
+                if (error.length() != 0)
+                {
+                    errors[id] = error;
+                }
+                else
+                {
+                    proofs[id] = proof;
+                }
+            }
+            REQUIRE(errors.size() == 1);
+            REQUIRE(errors[200] == "Invalid block");
+            for (unsigned int i = 0; i < sent.size(); i++)
+            {
+                REQUIRE(proofs[100 + i] == sent[i]);
+            }
+        }
+
+        // The connection is removed once the client disconnects
+        REQUIRE(waitForConnections(server, 0));
+    }
+
+    SECTION("Corrupted request ring")
+    {
+        // Connect without LocalClient so the shared memory can be written directly
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+        REQUIRE(connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0);
+        uint32_t nameLength = 0;
+        REQUIRE(recv(fd, &nameLength, sizeof(nameLength), MSG_WAITALL) == sizeof(nameLength));
+        std::string name(nameLength, '\0');
+        REQUIRE(recv(fd, &name[0], nameLength, MSG_WAITALL) == ssize_t(nameLength));
+        int shmFd = shm_open(name.c_str(), O_RDWR, 0600);
+        REQUIRE(shmFd >= 0);
+        size_t size = ShmSegment::getSize(1024 * 1024);
+        void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, shmFd, 0);
+        close(shmFd);
+        REQUIRE(memory != MAP_FAILED);
+        REQUIRE(waitForConnections(server, 1));
+
+        RingHeader* requests = static_cast<RingHeader*>(memory);
+        uint8_t* data = static_cast<uint8_t*>(memory) + 2 * sizeof(RingHeader);
+        SECTION("Record longer than the ring")
+        {
+            RecordHeader record = {1, uint32_t(RecordType::Prove), 0, uint64_t(1) << 40};
+            memcpy(data, &record, sizeof(record));
+            requests->tail = sizeof(record) + 16;
+        }
+        SECTION("Tail too far ahead of the head")
+        {
+            requests->tail = 4 * 1024 * 1024;
+        }
+        SECTION("Tail before the head")
+        {
+            requests->head = 100;
+            requests->tail = 50;
+        }
+        char doorbell = 1;
+        REQUIRE(send(fd, &doorbell, 1, MSG_NOSIGNAL) == 1);
+
+        // The server closes the connection
+        char buffer[64];
+        REQUIRE(recv(fd, buffer, sizeof(buffer), 0) == 0);
+        REQUIRE(waitForConnections(server, 0));
+        REQUIRE(blocks.empty());
+        munmap(memory, size);
+        close(fd);
+    }
+
+    server.stop();
+}
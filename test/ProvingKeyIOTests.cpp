@@ -0,0 +1,82 @@
+#include "../ThirdParty/catch.hpp"
+#include "TestUtils.h"
+
+#include "../Utils/ProvingKeyIO.h"
+
+template<typename PointT, typename CoordinateT>
+void checkRoundTrip(const PointT& point)
+{
+    CoordinateT x;
+    compressPoint(point, x);
+    PointT decompressed;
+    REQUIRE(decompressPoint(x, decompressed));
+    REQUIRE(decompressed == point);
+}
+
+// Changes x until the curve equation has no solution for y
+template<typename PointT, typename CoordinateT>
+CoordinateT getInvalidX(const PointT& point)
+{
+    CoordinateT x;
+    compressPoint(point, x);
+    libff::mp_limb_t flags = getFlagLimb(x);
+    getFlagLimb(x) &= ~(POINT_FLAG_INFINITY | POINT_FLAG_SIGN);
+    do
+    {
+        x = x + CoordinateT::one();
+    } while (isSquare(x.squared() * x + PointT::coeff_b));
+    getFlagLimb(x) |= flags;
+    return x;
+}
+
+TEST_CASE("ProvingKeyIO compression", "[ProvingKeyIO]")
+{
+    SECTION("G1 round trip")
+    {
+        checkRoundTrip<NativeG1, NativeFq>(NativeG1::zero());
+        checkRoundTrip<NativeG1, NativeFq>(NativeG1::one());
+        checkRoundTrip<NativeG1, NativeFq>(-NativeG1::one());
+        for (unsigned int i = 0; i < 16; i++)
+        {
+            checkRoundTrip<NativeG1, NativeFq>(NativeG1::random_element());
+        }
+    }
+
+    SECTION("G2 round trip")
+    {
+        checkRoundTrip<NativeG2, NativeFq2>(NativeG2::zero());
+        checkRoundTrip<NativeG2, NativeFq2>(NativeG2::one());
+        checkRoundTrip<NativeG2, NativeFq2>(-NativeG2::one());
+        for (unsigned int i = 0; i < 16; i++)
+        {
+            checkRoundTrip<NativeG2, NativeFq2>(NativeG2::random_element());
+        }
+    }
+
+    SECTION("Corrupted G1 point")
+    {
+        NativeFq x = getInvalidX<NativeG1, NativeFq>(NativeG1::random_element());
+        NativeG1 point;
+        REQUIRE_FALSE(decompressPoint(x, point));
+    }
+
+    SECTION("Corrupted G2 point")
+    {
+        NativeFq2 x = getInvalidX<NativeG2, NativeFq2>(NativeG2::random_element());
+        NativeG2 point;
+        REQUIRE_FALSE(decompressPoint(x, point));
+    }
+
+    SECTION("Squares")
+    {
+        for (unsigned int i = 0; i < 16; i++)
+        {
+            NativeFq a = NativeFq::random_element();
+            REQUIRE(isSquare(a.squared()));
+            NativeFq2 b = NativeFq2::random_element();
+            REQUIRE(isSquare(b.squared()));
+        }
+        // -1 is not a square in Fq (q = 3 mod 4)
+        REQUIRE_FALSE(isSquare(-NativeFq::one()));
+    }
+}